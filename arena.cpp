@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#include <algorithm>
+
+#include "arena.h"
+#include "pages.h"
+
+__thread ArenaCache sArenaCache LFMALLOC_TLS_INIT_EXEC;
+__thread Arena* sThreadArena LFMALLOC_TLS_INIT_EXEC = nullptr;
+
+// destroyed arenas, aba counter in low bits
+static std::atomic<uint64_t> sFreeArenas({ 0 });
+
+#define ARENA_SZ PAGE_CEILING(sizeof(Arena))
+
+void Arena::Track(std::atomic<Descriptor*>& list, Descriptor* desc)
+{
+    // list is only popped when the arena is destroyed, no aba
+    Descriptor* oldHead = list.load();
+    do {
+        desc->nextArena = oldHead;
+    } while (!list.compare_exchange_weak(oldHead, desc));
+}
+
+Arena* ArenaAlloc(uint32_t node)
+{
+    // reuse a destroyed arena
+    uint64_t oldHead = sFreeArenas.load();
+    uint64_t newHead;
+    Arena* arena;
+    do {
+        arena = (Arena*)(oldHead & ~PAGE_MASK);
+        if (!arena) {
+            break;
+        }
+
+        // arenas are never unmapped, safe to read even if stale
+        newHead = (arena->next.load() & ~PAGE_MASK) | (oldHead & PAGE_MASK);
+    } while (!sFreeArenas.compare_exchange_weak(oldHead, newHead));
+
+    if (!arena) {
+        // zero-filled, lists are empty
+        arena = (Arena*)PageAlloc(ARENA_SZ);
+        if (!arena) {
+            return nullptr;
+        }
+    }
+
+    for (size_t scIdx = 0; scIdx < MAX_SZ_IDX; ++scIdx) {
+        ProcHeap& heap = arena->heaps[scIdx];
+        for (PartialList& list : heap.partialList) {
+            list.head.store({ nullptr });
+        }
+
+        heap.scIdx = scIdx;
+        heap.node = node;
+        heap.arena = arena;
+    }
+
+    return arena;
+}
+
+void ArenaRecycle(Arena* arena)
+{
+    uint64_t oldHead = sFreeArenas.load();
+    uint64_t newHead;
+    do {
+        arena->next.store(oldHead);
+        newHead = (uint64_t)arena | ((oldHead + 1) & PAGE_MASK);
+    } while (!sFreeArenas.compare_exchange_weak(oldHead, newHead));
+}
+
+uint32_t ArenaCacheLimit(size_t scIdx)
+{
+    SizeClassData* sc = &SizeClasses[scIdx];
+    size_t limit = std::min<size_t>(ARENA_CACHE_SZ / sc->blockSize, sc->cacheBlockNum);
+    return std::max<size_t>(limit, 1);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#ifndef __ARENA_H_
+#define __ARENA_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "log.h"
+#include "lrmalloc.h"
+#include "lrmalloc_internal.h"
+#include "size_classes.h"
+#include "tcache.h"
+
+// bytes of blocks an arena cache bin holds, at least 1 block
+#define ARENA_CACHE_SZ (1ULL << 14)
+
+// explicit arena, with heaps of its own
+// superblocks taken by an arena stay with it, even once empty, and are
+//  all returned at once when the arena is destroyed
+// arenas are never unmapped, destroyed arenas are reused by
+//  lf_arena_create, so that stale thread caches can check the generation
+struct Arena {
+    // one heap per size class, with its own partial lists
+    ProcHeap heaps[MAX_SZ_IDX];
+    // superblocks and large blocks of the arena, linked with nextArena
+    // only pushed to while the arena is in use
+    std::atomic<Descriptor*> superblocks;
+    std::atomic<Descriptor*> largeBlocks;
+    // bumped when the arena is destroyed
+    std::atomic<uint64_t> generation;
+    // threads returning cached blocks to the arena's superblocks
+    std::atomic<uint32_t> flushers;
+    // next arena in list of destroyed arenas, aba counter in low bits
+    std::atomic<uint64_t> next;
+
+public:
+    // add superblock or large block descriptor to `list`
+    void Track(std::atomic<Descriptor*>& list, Descriptor* desc);
+};
+
+// thread cache for blocks of a single arena, the last one the thread
+//  allocated from
+struct ArenaCache {
+    Arena* arena = nullptr;
+    // generation of `arena` when blocks were cached
+    uint64_t generation = 0;
+    // limits are set on first use of a bin
+    TCacheBin bins[MAX_SZ_IDX];
+};
+
+extern __thread ArenaCache sArenaCache LFMALLOC_TLS_INIT_EXEC;
+// arena used by lf_arena_malloc when given nullptr
+extern __thread Arena* sThreadArena LFMALLOC_TLS_INIT_EXEC;
+
+// returns a new or reused arena, with empty heaps bound to `node`
+// returns nullptr if out of memory
+Arena* ArenaAlloc(uint32_t node);
+// make a destroyed arena available for reuse
+void ArenaRecycle(Arena* arena);
+// number of blocks an arena cache bin holds
+uint32_t ArenaCacheLimit(size_t scIdx);
+// return cached blocks to the superblocks of the cache's arena, unless
+//  the arena was destroyed since, and reset the cache
+// defined in lrmalloc.cpp
+void ArenaCacheFlush(ArenaCache* cache);
+
+#endif // __ARENA_H_
@@ -0,0 +1,112 @@
+#ifndef __BENCH_H_
+#define __BENCH_H_
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+// common harness for the macro benchmarks
+// each benchmark takes the number of threads and an optional scale factor,
+//  and reports a single csv line:
+//  bench,threads,ops,seconds,ops_per_sec,peak_rss_kb
+// benchmarks don't link lrmalloc, allocator is picked with LD_PRELOAD
+
+struct BenchArgs {
+    size_t threads = 1;
+    // multiplies the amount of work done
+    size_t scale = 1;
+};
+
+inline BenchArgs ParseArgs(int argc, char** argv)
+{
+    BenchArgs args;
+    if (argc > 1) {
+        args.threads = strtoul(argv[1], nullptr, 10);
+    }
+
+    if (argc > 2) {
+        args.scale = strtoul(argv[2], nullptr, 10);
+    }
+
+    if (args.threads == 0 || args.scale == 0) {
+        fprintf(stderr, "usage: %s [threads] [scale]\n", argv[0]);
+        exit(1);
+    }
+
+    return args;
+}
+
+inline double Now()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline long PeakRssKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+inline void Report(const char* name, size_t threads, uint64_t ops, double secs)
+{
+    printf("%s,%zu,%" PRIu64 ",%.3f,%.0f,%ld\n", name, threads, ops, secs,
+        ops / secs, PeakRssKb());
+}
+
+// run fn(idx) on `threads` threads, returns elapsed seconds
+template <typename F>
+double RunThreads(size_t threads, F fn)
+{
+    std::vector<std::thread> workers;
+    double start = Now();
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(fn, i);
+    }
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    return Now() - start;
+}
+
+// xorshift64, cheap enough to not show up in profiles
+struct Rng {
+    uint64_t state;
+
+    explicit Rng(uint64_t seed)
+        : state(seed * 0x9E3779B97F4A7C15ULL + 1)
+    {
+    }
+
+    uint64_t Next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    // uniform in [min, max]
+    size_t Range(size_t min, size_t max)
+    {
+        return min + Next() % (max - min + 1);
+    }
+};
+
+// keep the compiler from optimizing away allocations
+inline void Touch(void* ptr)
+{
+    asm volatile("" : : "r"(ptr) : "memory");
+}
+
+#endif // __BENCH_H_
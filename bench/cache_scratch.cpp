@@ -0,0 +1,39 @@
+#include <cstdlib>
+
+#include "bench.h"
+
+// hoard's cache-scratch, passive false sharing
+// the main thread allocates one small object per thread, all likely on
+//  the same cache line, each thread frees its object and then repeatedly
+//  allocates and writes objects of the same size
+// an allocator that hands the freed object to the next allocation of
+//  another thread makes threads write to the same line
+
+static constexpr size_t OBJ_SIZE = 8;
+static constexpr size_t ITERATIONS = 100000;
+static constexpr size_t WRITES = 1000;
+
+int main(int argc, char** argv)
+{
+    BenchArgs args = ParseArgs(argc, argv);
+    std::vector<char*> initial(args.threads);
+    for (char*& obj : initial) {
+        obj = (char*)malloc(OBJ_SIZE);
+    }
+
+    double secs = RunThreads(args.threads, [&](size_t idx) {
+        free(initial[idx]);
+        for (size_t i = 0; i < ITERATIONS * args.scale; ++i) {
+            char* obj = (char*)malloc(OBJ_SIZE);
+            for (size_t w = 0; w < WRITES; ++w) {
+                obj[w % OBJ_SIZE] = (char)w;
+                Touch(obj);
+            }
+
+            free(obj);
+        }
+    });
+
+    Report("cache-scratch", args.threads, args.threads * ITERATIONS * args.scale * WRITES, secs);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include <cstdlib>
+
+#include "bench.h"
+
+// hoard's cache-thrash, active false sharing
+// each thread repeatedly allocates a small object, writes to it and
+//  frees it
+// an allocator that carves objects of different threads out of the
+//  same cache line makes threads write to the same line
+
+static constexpr size_t OBJ_SIZE = 8;
+static constexpr size_t ITERATIONS = 100000;
+static constexpr size_t WRITES = 1000;
+
+int main(int argc, char** argv)
+{
+    BenchArgs args = ParseArgs(argc, argv);
+
+    double secs = RunThreads(args.threads, [&](size_t idx) {
+        for (size_t i = 0; i < ITERATIONS * args.scale; ++i) {
+            char* obj = (char*)malloc(OBJ_SIZE);
+            for (size_t w = 0; w < WRITES; ++w) {
+                obj[w % OBJ_SIZE] = (char)w;
+                Touch(obj);
+            }
+
+            free(obj);
+        }
+    });
+
+    Report("cache-thrash", args.threads, args.threads * ITERATIONS * args.scale * WRITES, secs);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#include <cstdlib>
+
+#include <atomic>
+
+#include "bench.h"
+
+// larson server simulation
+// each lane holds a set of live blocks of random sizes, a round replaces
+//  random blocks with new ones and then hands the set over to a new
+//  thread, so blocks are freed by threads other than the one that
+//  allocated them and threads come and go
+// Larson & Krishnan, "Memory Allocation for Long-Running Server
+//  Applications", ISMM 1998
+
+static constexpr size_t MIN_SIZE = 10;
+static constexpr size_t MAX_SIZE = 500;
+static constexpr size_t SLOTS = 1000;
+static constexpr size_t ROUND_OPS = 10000;
+static constexpr size_t ROUNDS = 40;
+
+int main(int argc, char** argv)
+{
+    BenchArgs args = ParseArgs(argc, argv);
+    std::atomic<uint64_t> ops { 0 };
+
+    double secs = RunThreads(args.threads, [&](size_t idx) {
+        std::vector<void*> slots(SLOTS);
+        Rng rng(idx);
+        for (void*& slot : slots) {
+            slot = malloc(rng.Range(MIN_SIZE, MAX_SIZE));
+        }
+
+        for (size_t round = 0; round < ROUNDS * args.scale; ++round) {
+            std::thread worker([&]() {
+                Rng local(rng.Next());
+                for (size_t i = 0; i < ROUND_OPS; ++i) {
+                    void*& slot = slots[local.Next() % SLOTS];
+                    free(slot);
+                    slot = malloc(local.Range(MIN_SIZE, MAX_SIZE));
+                    Touch(slot);
+                }
+            });
+            worker.join();
+        }
+
+        for (void* slot : slots) {
+            free(slot);
+        }
+
+        ops += ROUNDS * args.scale * ROUND_OPS;
+    });
+
+    Report("larson", args.threads, ops, secs);
+    return 0;
+}
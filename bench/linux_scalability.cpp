@@ -0,0 +1,35 @@
+#include <cstdlib>
+
+#include "bench.h"
+
+// linux-scalability
+// each thread allocates a large batch of fixed-size objects and then
+//  frees them all, many times over
+// Lever & Boreham, "malloc() Performance in a Multithreaded Linux
+//  Environment", USENIX 2000
+
+static constexpr size_t OBJ_SIZE = 512;
+static constexpr size_t BATCH = 100000;
+static constexpr size_t ITERATIONS = 20;
+
+int main(int argc, char** argv)
+{
+    BenchArgs args = ParseArgs(argc, argv);
+
+    double secs = RunThreads(args.threads, [&](size_t idx) {
+        std::vector<void*> batch(BATCH);
+        for (size_t i = 0; i < ITERATIONS * args.scale; ++i) {
+            for (void*& obj : batch) {
+                obj = malloc(OBJ_SIZE);
+                Touch(obj);
+            }
+
+            for (void* obj : batch) {
+                free(obj);
+            }
+        }
+    });
+
+    Report("linux-scalability", args.threads, 2 * args.threads * ITERATIONS * args.scale * BATCH, secs);
+    return 0;
+}
@@ -0,0 +1,312 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../bench.h"
+
+// rss over time under phase-changing workloads
+// each cycle runs these phases:
+//  grow      threads allocate small mixed sizes up to the live target
+//  shrink    90% of the blocks are freed in random order, survivors are
+//            scattered over most superblocks
+//  shift     medium sizes are allocated up to the live target, then freed
+//  churn     short-lived threads allocate, blocks are freed by others
+//  strand    threads free bursts and go idle with full thread caches
+//  drain     everything left is freed
+// a sampler thread reads Rss from /proc/self/smaps_rollup and pairs it
+//  with the bytes requested by live blocks
+// prints csv, one row per sample:
+//  sample,allocator,elapsed_s,cycle,phase,live_kb,rss_kb,frag_ratio
+// then one summary row:
+//  summary,allocator,peak_rss_kb,peak_live_kb,max_frag_ratio,final_rss_kb,returned_kb
+// frag_ratio is rss / live, only meaningful while live is large
+// returned_kb is how much of the peak rss was given back after the drain
+//
+// usage: fragmentation [threads] [cycles] [live MB]
+
+#define SAMPLE_MS 50
+#define MIN_SAMPLE_LIVE (1 << 20)
+
+static std::atomic<int64_t> sLive { 0 };
+static std::atomic<int> sPhase { 0 };
+static std::atomic<int> sCycle { 0 };
+static std::atomic<bool> sDone { false };
+
+static const char* sPhaseNames[] = { "grow", "shrink", "shift", "churn", "strand", "drain" };
+
+struct Block {
+    void* ptr;
+    size_t size;
+};
+
+static void* Alloc(size_t size)
+{
+    void* ptr = malloc(size);
+    memset(ptr, 0xAB, size);
+    sLive += size;
+    return ptr;
+}
+
+static void Free(Block& block)
+{
+    free(block.ptr);
+    sLive -= block.size;
+    block.ptr = nullptr;
+}
+
+// rss in kB, without allocating
+static long ReadRssKb()
+{
+    static char buf[4096];
+    int fd = open("/proc/self/smaps_rollup", O_RDONLY);
+    if (fd < 0) {
+        // older kernels, statm is in pages
+        fd = open("/proc/self/statm", O_RDONLY);
+        ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        buf[len > 0 ? len : 0] = '\0';
+        long pages = 0;
+        sscanf(buf, "%*ld %ld", &pages);
+        return pages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    buf[len > 0 ? len : 0] = '\0';
+    const char* rss = strstr(buf, "\nRss:");
+    return rss ? strtol(rss + 5, nullptr, 10) : 0;
+}
+
+struct Sample {
+    double elapsed;
+    int cycle;
+    int phase;
+    int64_t live;
+    long rss;
+};
+
+// workers of one phase, each with its own blocks
+struct Workers {
+    size_t threads;
+    size_t liveTarget;
+    std::vector<std::vector<Block>> blocks;
+
+    Workers(size_t threads, size_t liveTarget)
+        : threads(threads)
+        , liveTarget(liveTarget)
+        , blocks(threads)
+    {
+    }
+
+    void Grow(size_t cycle, size_t minSize, size_t maxSize)
+    {
+        RunThreads(threads, [&](size_t idx) {
+            Rng rng(cycle * threads + idx);
+            size_t bytes = 0;
+            while (bytes < liveTarget / threads) {
+                size_t size = rng.Range(minSize, maxSize);
+                blocks[idx].push_back({ Alloc(size), size });
+                bytes += size;
+            }
+        });
+    }
+
+    // free `fraction` of each thread's blocks, in random order
+    void Shrink(size_t cycle, double fraction)
+    {
+        RunThreads(threads, [&](size_t idx) {
+            Rng rng(cycle * threads + idx);
+            std::vector<Block>& own = blocks[idx];
+            for (Block& block : own) {
+                if (rng.Next() % 1000 < fraction * 1000) {
+                    Free(block);
+                }
+            }
+
+            size_t live = 0;
+            for (Block& block : own) {
+                if (block.ptr) {
+                    own[live++] = block;
+                }
+            }
+
+            own.resize(live);
+        });
+    }
+};
+
+// blocks are allocated by short-lived threads and freed by a neighbour
+//  in the next round
+static void Churn(size_t threads, size_t liveTarget, size_t cycle)
+{
+    std::vector<std::vector<Block>> prev(threads);
+    std::vector<std::vector<Block>> next(threads);
+    for (size_t round = 0; round < 32; ++round) {
+        RunThreads(threads, [&](size_t idx) {
+            for (Block& block : prev[(idx + 1) % threads]) {
+                Free(block);
+            }
+
+            Rng rng(round * threads + idx + cycle);
+            std::vector<Block>& own = next[idx];
+            own.clear();
+            size_t bytes = 0;
+            while (bytes < liveTarget / threads / 8) {
+                size_t size = rng.Range(16, 2048);
+                own.push_back({ Alloc(size), size });
+                bytes += size;
+            }
+        });
+        std::swap(prev, next);
+    }
+
+    for (std::vector<Block>& own : prev) {
+        for (Block& block : own) {
+            Free(block);
+        }
+    }
+}
+
+// threads allocate and free bursts, then idle while holding cached blocks
+static void Strand(size_t threads, size_t cycle, double sampleSecs)
+{
+    std::mutex lock;
+    std::condition_variable cond;
+    size_t idle = 0;
+    bool release = false;
+
+    std::vector<std::thread> workers;
+    for (size_t idx = 0; idx < threads; ++idx) {
+        workers.emplace_back([&, idx]() {
+            Rng rng(cycle * threads + idx);
+            std::vector<Block> burst;
+            for (size_t i = 0; i < 4096; ++i) {
+                size_t size = rng.Range(16, 4096);
+                burst.push_back({ Alloc(size), size });
+            }
+
+            for (Block& block : burst) {
+                Free(block);
+            }
+
+            std::unique_lock<std::mutex> guard(lock);
+            ++idle;
+            cond.notify_all();
+            cond.wait(guard, [&]() { return release; });
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        cond.wait(guard, [&]() { return idle == threads; });
+    }
+
+    // let the sampler see the idle threads
+    std::this_thread::sleep_for(std::chrono::duration<double>(sampleSecs));
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        release = true;
+    }
+    cond.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4;
+    size_t cycles = argc > 2 ? strtoul(argv[2], nullptr, 10) : 3;
+    size_t liveTarget = (argc > 3 ? strtoul(argv[3], nullptr, 10) : 128) << 20;
+    if (threads == 0 || cycles == 0 || liveTarget == 0) {
+        fprintf(stderr, "usage: %s [threads] [cycles] [live MB]\n", argv[0]);
+        return 1;
+    }
+
+    // lrmalloc exports lf_mallctl
+    const char* allocator = dlsym(RTLD_DEFAULT, "lf_mallctl") ? "lrmalloc" : "system";
+
+    std::vector<Sample> samples;
+    samples.reserve(1 << 16);
+    double start = Now();
+    auto sample = [&]() {
+        if (samples.size() < samples.capacity()) {
+            samples.push_back({ Now() - start, sCycle, sPhase, sLive, ReadRssKb() });
+        }
+    };
+
+    std::mutex sampleLock;
+    std::thread sampler([&]() {
+        while (!sDone) {
+            {
+                std::lock_guard<std::mutex> guard(sampleLock);
+                sample();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLE_MS));
+        }
+    });
+
+    // samples at phase ends, when live bytes are stable
+    auto endPhase = [&](int next) {
+        std::lock_guard<std::mutex> guard(sampleLock);
+        sample();
+        sPhase = next;
+    };
+
+    for (size_t cycle = 0; cycle < cycles; ++cycle) {
+        sCycle = cycle;
+        Workers small(threads, liveTarget);
+        small.Grow(cycle, 16, 1024);
+        endPhase(1);
+        small.Shrink(cycle, 0.9);
+        endPhase(2);
+
+        Workers medium(threads, liveTarget);
+        medium.Grow(cycle, 2048, 16384);
+        medium.Shrink(cycle, 1.0);
+        endPhase(3);
+
+        Churn(threads, liveTarget, cycle);
+        endPhase(4);
+        Strand(threads, cycle, 4.0 * SAMPLE_MS / 1000);
+        endPhase(5);
+
+        small.Shrink(cycle, 1.0);
+        endPhase(0);
+    }
+
+    sDone = true;
+    sampler.join();
+
+    long peakRss = 0;
+    int64_t peakLive = 0;
+    double maxFrag = 0.0;
+    printf("sample,allocator,elapsed_s,cycle,phase,live_kb,rss_kb,frag_ratio\n");
+    for (const Sample& s : samples) {
+        double frag = s.live > 0 ? s.rss * 1024.0 / s.live : 0.0;
+        if (s.live >= MIN_SAMPLE_LIVE) {
+            maxFrag = std::max(maxFrag, frag);
+        }
+
+        peakRss = std::max(peakRss, s.rss);
+        peakLive = std::max(peakLive, s.live);
+        printf("sample,%s,%.3f,%d,%s,%ld,%ld,%.3f\n", allocator, s.elapsed, s.cycle,
+            sPhaseNames[s.phase], (long)(s.live / 1024), s.rss, frag);
+    }
+
+    long finalRss = ReadRssKb();
+    printf("summary,allocator,peak_rss_kb,peak_live_kb,max_frag_ratio,final_rss_kb,returned_kb\n");
+    printf("summary,%s,%ld,%ld,%.3f,%ld,%ld\n", allocator, std::max(peakRss, PeakRssKb()),
+        (long)(peakLive / 1024), maxFrag, finalRss, peakRss - finalRss);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <random>
+#include <vector>
+
+#include "../../lrmalloc.h"
+#include "../bench.h"
+
+// free and malloc bursts of random length over a live set, which fill
+//  and drain the thread cache bin of one size class
+// bursts longer than the bin limit make it flush, shorter ones are
+//  served from the bin
+// prints csv:
+//  size,max_burst,iterations,best_seconds,mean_seconds
+//
+// usage: burst <size> <max burst> <iterations> [runs]
+
+#define DEFAULT_RUNS 5
+
+static double Run(size_t size, size_t maxBurst, size_t iterations)
+{
+    std::mt19937 rng(1);
+    std::vector<void*> live;
+    live.reserve(maxBurst * 10);
+    for (size_t i = 0; i < maxBurst * 4; ++i) {
+        live.push_back(malloc(size));
+    }
+
+    double start = Now();
+    for (size_t it = 0; it < iterations; ++it) {
+        size_t frees = rng() % maxBurst + 1;
+        for (size_t k = 0; k < frees && !live.empty(); ++k) {
+            free(live.back());
+            live.pop_back();
+        }
+
+        size_t mallocs = rng() % maxBurst + 1;
+        for (size_t k = 0; k < mallocs; ++k) {
+            void* ptr = malloc(size);
+            *(char*)ptr = 1;
+            live.push_back(ptr);
+        }
+
+        // keep the live set bounded
+        if (live.size() > maxBurst * 8) {
+            for (size_t k = 0; k < maxBurst; ++k) {
+                free(live.back());
+                live.pop_back();
+            }
+        }
+    }
+
+    double secs = Now() - start;
+    for (void* ptr : live) {
+        free(ptr);
+    }
+
+    return secs;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <size> <max burst> <iterations> [runs]\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = strtoul(argv[1], nullptr, 10);
+    size_t maxBurst = strtoul(argv[2], nullptr, 10);
+    size_t iterations = strtoul(argv[3], nullptr, 10);
+    size_t runs = argc > 4 ? strtoul(argv[4], nullptr, 10) : DEFAULT_RUNS;
+    if (size == 0 || maxBurst == 0 || runs == 0) {
+        fprintf(stderr, "usage: %s <size> <max burst> <iterations> [runs]\n", argv[0]);
+        return 1;
+    }
+
+    double best = 1e9;
+    double total = 0.0;
+    for (size_t run = 0; run < runs; ++run) {
+        double secs = Run(size, maxBurst, iterations);
+        best = std::min(best, secs);
+        total += secs;
+    }
+
+    printf("%zu,%zu,%zu,%.2f,%.2f\n", size, maxBurst, iterations, best, total / runs);
+    return 0;
+}
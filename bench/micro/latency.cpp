@@ -0,0 +1,230 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#include "../../lrmalloc.h"
+#include "../bench.h"
+
+// fast path latency per size class
+// links lrmalloc directly to read size classes and fill/flush counts
+// each sample times BATCH operations with the timestamp counter and is
+//  recorded as ns per op, percentiles show the cost of the slow paths
+//  (FillCache, FlushCache) that a fraction of the ops take
+// prints csv:
+//  op,size_class,size,p50_ns,p90_ns,p99_ns,p999_ns,mean_ns,fills_per_kop,flushes_per_kop
+// fills and flushes include untimed setup and teardown ops, and are only
+//  counted with LFMALLOC_STATS, -1 otherwise
+//
+// usage: latency [op filter] [samples]
+
+#define BATCH 64
+#define DEFAULT_SAMPLES 1000
+
+static inline uint64_t ReadTsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // builtins, x86intrin.h clashes with the posix_memalign declaration
+    __builtin_ia32_lfence();
+    uint64_t tsc = __builtin_ia32_rdtsc();
+    __builtin_ia32_lfence();
+    return tsc;
+#else
+    return (uint64_t)(Now() * 1e9);
+#endif
+}
+
+static double sTscPerNs = 1.0;
+// cost of an empty timed region, in ticks
+static uint64_t sTscOverhead = 0;
+
+static void CalibrateTsc()
+{
+    double start = Now();
+    uint64_t tscStart = ReadTsc();
+    while (Now() - start < 0.1) {
+    }
+
+    sTscPerNs = (ReadTsc() - tscStart) / ((Now() - start) * 1e9);
+
+    sTscOverhead = UINT64_MAX;
+    for (size_t i = 0; i < 1000; ++i) {
+        uint64_t t0 = ReadTsc();
+        uint64_t t1 = ReadTsc();
+        sTscOverhead = std::min(sTscOverhead, t1 - t0);
+    }
+}
+
+static uint64_t Ctl(const std::string& name)
+{
+    uint64_t value = 0;
+    size_t len = sizeof(value);
+    if (lf_mallctl(name.c_str(), &value, &len, nullptr, 0) != 0) {
+        return 0;
+    }
+
+    return value;
+}
+
+static uint64_t BinCtl(size_t scIdx, const char* stat)
+{
+    return Ctl("stats.bins." + std::to_string(scIdx) + "." + stat);
+}
+
+struct Op {
+    const char* name;
+    // untimed, prepares the batch
+    std::function<void(void**, size_t)> setup;
+    // timed, runs BATCH ops
+    std::function<void(void**, size_t)> run;
+    // untimed, releases what's left
+    std::function<void(void**, size_t)> teardown;
+};
+
+static void Nop(void**, size_t)
+{
+}
+
+static void AllocAll(void** ptrs, size_t size)
+{
+    for (size_t i = 0; i < BATCH; ++i) {
+        ptrs[i] = malloc(size);
+    }
+}
+
+static void FreeAll(void** ptrs, size_t)
+{
+    for (size_t i = 0; i < BATCH; ++i) {
+        free(ptrs[i]);
+    }
+}
+
+static void Measure(const Op& op, size_t scIdx, size_t size, size_t samples, bool stats)
+{
+    std::vector<double> ns(samples);
+    void* ptrs[BATCH];
+
+    // warm up thread cache and superblocks
+    for (size_t s = 0; s < 16; ++s) {
+        op.setup(ptrs, size);
+        op.run(ptrs, size);
+        op.teardown(ptrs, size);
+    }
+
+    uint64_t fills = BinCtl(scIdx, "nfills");
+    uint64_t flushes = BinCtl(scIdx, "nflushes");
+    double total = 0.0;
+    for (size_t s = 0; s < samples; ++s) {
+        op.setup(ptrs, size);
+        uint64_t t0 = ReadTsc();
+        op.run(ptrs, size);
+        uint64_t t1 = ReadTsc();
+        op.teardown(ptrs, size);
+
+        uint64_t ticks = t1 - t0 > sTscOverhead ? t1 - t0 - sTscOverhead : 0;
+        ns[s] = ticks / sTscPerNs / BATCH;
+        total += ns[s];
+    }
+
+    double kops = samples * BATCH / 1000.0;
+    double fillsPerKop = -1.0;
+    double flushesPerKop = -1.0;
+    if (stats) {
+        fillsPerKop = (BinCtl(scIdx, "nfills") - fills) / kops;
+        flushesPerKop = (BinCtl(scIdx, "nflushes") - flushes) / kops;
+    }
+
+    std::sort(ns.begin(), ns.end());
+    auto pct = [&](double p) { return ns[std::min(samples - 1, (size_t)(p * samples))]; };
+    printf("%s,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f\n", op.name, scIdx, size,
+        pct(0.5), pct(0.9), pct(0.99), pct(0.999), total / samples, fillsPerKop,
+        flushesPerKop);
+}
+
+int main(int argc, char** argv)
+{
+    const char* filter = argc > 1 ? argv[1] : "";
+    size_t samples = argc > 2 ? strtoul(argv[2], nullptr, 10) : DEFAULT_SAMPLES;
+    if (samples == 0) {
+        fprintf(stderr, "usage: %s [op filter] [samples]\n", argv[0]);
+        return 1;
+    }
+
+    CalibrateTsc();
+    bool stats = Ctl("stats.enabled") != 0;
+    size_t binCount = Ctl("bins.count");
+
+    Op ops[] = {
+        // malloc immediately followed by free, the common case
+        { "malloc-free", Nop,
+            [](void** ptrs, size_t size) {
+                for (size_t i = 0; i < BATCH; ++i) {
+                    void* ptr = malloc(size);
+                    Touch(ptr);
+                    free(ptr);
+                }
+            },
+            Nop },
+        // bursts drain and refill the thread cache
+        { "alloc-burst", Nop,
+            [](void** ptrs, size_t size) {
+                for (size_t i = 0; i < BATCH; ++i) {
+                    ptrs[i] = malloc(size);
+                    Touch(ptrs[i]);
+                }
+            },
+            FreeAll },
+        { "free-burst", AllocAll, FreeAll, Nop },
+        { "aligned_alloc", Nop,
+            [](void** ptrs, size_t size) {
+                for (size_t i = 0; i < BATCH; ++i) {
+                    void* ptr = aligned_alloc(64, (size + 63) & ~63UL);
+                    Touch(ptr);
+                    free(ptr);
+                }
+            },
+            Nop },
+        { "calloc", Nop,
+            [](void** ptrs, size_t size) {
+                for (size_t i = 0; i < BATCH; ++i) {
+                    void* ptr = calloc(1, size);
+                    Touch(ptr);
+                    free(ptr);
+                }
+            },
+            Nop },
+        // grow blocks of about half the size into this size class
+        { "realloc-grow",
+            [](void** ptrs, size_t size) {
+                for (size_t i = 0; i < BATCH; ++i) {
+                    ptrs[i] = malloc(size / 2 + 1);
+                }
+            },
+            [](void** ptrs, size_t size) {
+                for (size_t i = 0; i < BATCH; ++i) {
+                    ptrs[i] = realloc(ptrs[i], size);
+                    Touch(ptrs[i]);
+                }
+            },
+            FreeAll },
+    };
+
+    printf("op,size_class,size,p50_ns,p90_ns,p99_ns,p999_ns,mean_ns,fills_per_kop,flushes_per_kop\n");
+    for (const Op& op : ops) {
+        if (strstr(op.name, filter) == nullptr) {
+            continue;
+        }
+
+        // size class 0 is for large allocations
+        for (size_t scIdx = 1; scIdx < binCount; ++scIdx) {
+            Measure(op, scIdx, Ctl("bins." + std::to_string(scIdx) + ".size"), samples, stats);
+        }
+    }
+
+    return 0;
+}
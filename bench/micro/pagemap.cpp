@@ -0,0 +1,88 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "../../lrmalloc.h"
+#include "../bench.h"
+
+// free path cost of the pagemap lookup
+// frees 1M blocks of 16-464 bytes in allocation order and shuffled, the
+//  latter missing the cache on both the block and its pagemap entries
+// make pagemapbench runs it against the flat array and the radix tree
+//  (LFMALLOC_PAGEMAP_RADIX) pagemaps
+// prints csv:
+//  pagemap,order,blocks,best_ns_per_free,mean_ns_per_free,vm_size_kb
+//
+// usage: pagemap [label] [runs]
+
+#define BLOCKS (1 << 20)
+#define DEFAULT_RUNS 15
+
+static long VmSizeKb()
+{
+    long size = -1;
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file == nullptr) {
+        return size;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "VmSize:", 7) == 0) {
+            size = strtol(line + 7, nullptr, 10);
+            break;
+        }
+    }
+
+    fclose(file);
+    return size;
+}
+
+static void Measure(const char* label, const char* order, bool shuffle, size_t runs)
+{
+    std::vector<void*> ptrs(BLOCKS);
+    std::mt19937_64 rng(42);
+    double best = 1e9;
+    double total = 0.0;
+    for (size_t run = 0; run < runs; ++run) {
+        for (size_t i = 0; i < BLOCKS; ++i) {
+            ptrs[i] = malloc(16 + (i % 57) * 8);
+            Touch(ptrs[i]);
+        }
+
+        if (shuffle) {
+            std::shuffle(ptrs.begin(), ptrs.end(), rng);
+        }
+
+        double start = Now();
+        for (void* ptr : ptrs) {
+            free(ptr);
+        }
+
+        double ns = (Now() - start) * 1e9 / BLOCKS;
+        best = std::min(best, ns);
+        total += ns;
+    }
+
+    printf("%s,%s,%d,%.1f,%.1f,%ld\n", label, order, BLOCKS, best, total / runs, VmSizeKb());
+}
+
+int main(int argc, char** argv)
+{
+    const char* label = argc > 1 ? argv[1] : "lrmalloc";
+    size_t runs = argc > 2 ? strtoul(argv[2], nullptr, 10) : DEFAULT_RUNS;
+    if (runs == 0) {
+        fprintf(stderr, "usage: %s [label] [runs]\n", argv[0]);
+        return 1;
+    }
+
+    printf("pagemap,order,blocks,best_ns_per_free,mean_ns_per_free,vm_size_kb\n");
+    Measure(label, "sequential", false, runs);
+    Measure(label, "shuffled", true, runs);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Copyright (C) 2019 Ricardo Leite. All rights reserved.
+# Licenced under the MIT licence. See COPYING file in the project root for details.
+#
+# Runs every benchmark against lrmalloc and the system allocator, selected
+#  with LD_PRELOAD, for a range of thread counts.
+# Prints csv to stdout:
+#  allocator,bench,threads,ops,seconds,ops_per_sec,peak_rss_kb
+#
+# BENCH_THREADS     thread counts, default powers of 2 up to nproc
+# BENCH_SCALE       work multiplier, default 1
+# BENCH_ALLOCATORS  name=library pairs, default lrmalloc and glibc
+#                   an empty library runs without LD_PRELOAD
+# BENCH_FILTER      only run benchmarks whose name contains this
+
+dir=$(cd "$(dirname "$0")" && pwd)
+
+if [ -z "$BENCH_THREADS" ]; then
+    nproc=$(nproc)
+    BENCH_THREADS=""
+    t=1
+    while [ "$t" -lt "$nproc" ]; do
+        BENCH_THREADS="$BENCH_THREADS $t"
+        t=$((t * 2))
+    done
+    BENCH_THREADS="$BENCH_THREADS $nproc"
+fi
+
+BENCH_SCALE=${BENCH_SCALE:-1}
+BENCH_ALLOCATORS=${BENCH_ALLOCATORS:-"lrmalloc=$dir/../liblrmalloc.so glibc="}
+
+echo "allocator,bench,threads,ops,seconds,ops_per_sec,peak_rss_kb"
+for bench in "$dir"/*.bench; do
+    case "$(basename "$bench")" in
+        *"$BENCH_FILTER"*) ;;
+        *) continue ;;
+    esac
+
+    for threads in $BENCH_THREADS; do
+        for alloc in $BENCH_ALLOCATORS; do
+            name=${alloc%%=*}
+            lib=${alloc#*=}
+            if ! out=$(LD_PRELOAD=$lib "$bench" "$threads" "$BENCH_SCALE"); then
+                echo "$name: $(basename "$bench") failed with $threads threads" >&2
+                continue
+            fi
+
+            echo "$name,$out"
+        done
+    done
+done
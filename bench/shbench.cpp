@@ -0,0 +1,64 @@
+#include <cstdlib>
+
+#include "bench.h"
+
+// shbench-like mixed workload
+// each thread allocates objects of mixed sizes, mostly small with a tail
+//  of larger ones, and frees them after varying lifetimes: half of each
+//  batch right away, the rest a few batches later in random order
+// modeled after MicroQuill's SmartHeap benchmark
+
+static constexpr size_t BATCH = 1000;
+static constexpr size_t BATCHES = 2000;
+// batches a long-lived object survives
+static constexpr size_t LIFETIME = 8;
+
+static size_t MixedSize(Rng& rng)
+{
+    uint64_t r = rng.Next() % 100;
+    if (r < 80) {
+        return rng.Range(1, 128);
+    }
+
+    if (r < 98) {
+        return rng.Range(129, 4096);
+    }
+
+    return rng.Range(4097, 64 * 1024);
+}
+
+int main(int argc, char** argv)
+{
+    BenchArgs args = ParseArgs(argc, argv);
+
+    double secs = RunThreads(args.threads, [&](size_t idx) {
+        Rng rng(idx);
+        std::vector<void*> live(LIFETIME * BATCH, nullptr);
+        std::vector<void*> batch(BATCH);
+        for (size_t i = 0; i < BATCHES * args.scale; ++i) {
+            for (void*& obj : batch) {
+                obj = malloc(MixedSize(rng));
+                Touch(obj);
+            }
+
+            for (size_t b = 0; b < BATCH; ++b) {
+                if (b % 2 == 0) {
+                    free(batch[b]);
+                    continue;
+                }
+
+                // replace a random long-lived object
+                void*& slot = live[rng.Next() % live.size()];
+                free(slot);
+                slot = batch[b];
+            }
+        }
+
+        for (void* obj : live) {
+            free(obj);
+        }
+    });
+
+    Report("shbench", args.threads, 2 * args.threads * BATCHES * args.scale * BATCH, secs);
+    return 0;
+}
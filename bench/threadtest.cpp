@@ -0,0 +1,36 @@
+#include <cstdlib>
+
+#include "bench.h"
+
+// hoard's threadtest
+// a fixed amount of work is split among threads, each repeatedly
+//  allocates a batch of objects and frees them all in allocation order
+// Berger et al., "Hoard: A Scalable Memory Allocator for Multithreaded
+//  Applications", ASPLOS 2000
+
+static constexpr size_t OBJ_SIZE = 64;
+static constexpr size_t BATCH = 10000;
+static constexpr size_t ITERATIONS = 800;
+
+int main(int argc, char** argv)
+{
+    BenchArgs args = ParseArgs(argc, argv);
+    size_t iterations = ITERATIONS * args.scale / args.threads;
+
+    double secs = RunThreads(args.threads, [&](size_t idx) {
+        std::vector<void*> batch(BATCH);
+        for (size_t i = 0; i < iterations; ++i) {
+            for (void*& obj : batch) {
+                obj = malloc(OBJ_SIZE);
+                Touch(obj);
+            }
+
+            for (void* obj : batch) {
+                free(obj);
+            }
+        }
+    });
+
+    Report("threadtest", args.threads, 2 * iterations * args.threads * BATCH, secs);
+    return 0;
+}
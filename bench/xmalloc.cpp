@@ -0,0 +1,78 @@
+#include <cstdlib>
+
+#include <condition_variable>
+#include <mutex>
+
+#include "bench.h"
+
+// xmalloc producer/consumer
+// threads are paired, producers allocate batches of blocks and hand them
+//  to their consumer, which frees them
+// every free is remote, exercises the cross-thread free path
+// Lever & Boreham, "malloc() Performance in a Multithreaded Linux
+//  Environment", USENIX 2000
+
+static constexpr size_t MIN_SIZE = 8;
+static constexpr size_t MAX_SIZE = 256;
+static constexpr size_t BATCH = 256;
+static constexpr size_t BATCHES = 4000;
+// max batches in flight per pair
+static constexpr size_t QUEUE_DEPTH = 16;
+
+struct BatchQueue {
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<void**> batches;
+
+    void Push(void** batch)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        cond.wait(guard, [&]() { return batches.size() < QUEUE_DEPTH; });
+        batches.push_back(batch);
+        cond.notify_all();
+    }
+
+    void** Pop()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        cond.wait(guard, [&]() { return !batches.empty(); });
+        void** batch = batches.back();
+        batches.pop_back();
+        cond.notify_all();
+        return batch;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    BenchArgs args = ParseArgs(argc, argv);
+    // at least one pair
+    size_t pairs = (args.threads + 1) / 2;
+    std::vector<BatchQueue> queues(pairs);
+
+    double secs = RunThreads(2 * pairs, [&](size_t idx) {
+        BatchQueue& queue = queues[idx / 2];
+        for (size_t i = 0; i < BATCHES * args.scale; ++i) {
+            if (idx % 2 == 0) {
+                Rng rng(idx * BATCHES + i);
+                void** batch = (void**)malloc(BATCH * sizeof(void*));
+                for (size_t b = 0; b < BATCH; ++b) {
+                    batch[b] = malloc(rng.Range(MIN_SIZE, MAX_SIZE));
+                    Touch(batch[b]);
+                }
+
+                queue.Push(batch);
+            } else {
+                void** batch = queue.Pop();
+                for (size_t b = 0; b < BATCH; ++b) {
+                    free(batch[b]);
+                }
+
+                free(batch);
+            }
+        }
+    });
+
+    Report("xmalloc", 2 * pairs, 2 * pairs * BATCHES * args.scale * (BATCH + 1), secs);
+    return 0;
+}
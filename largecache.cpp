@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#include "largecache.h"
+
+#include "pages.h"
+
+LargeCache sLargeCache;
+
+Descriptor* LargeCache::Alloc(size_t size)
+{
+    if (size > LARGE_CACHE_MAX_SZ) {
+        return nullptr;
+    }
+
+    Descriptor* desc = PopBin(LargeCacheIdx(size));
+    if (desc) {
+        ASSERT(desc->blockSize == LargeSizeCeiling(size));
+        _bytes.fetch_sub(desc->blockSize);
+    }
+
+    return desc;
+}
+
+bool LargeCache::Free(Descriptor* desc)
+{
+    size_t size = desc->blockSize;
+    // only cache mappings with a size that can be reused by
+    //  another allocation in the same bin
+    if (size > LARGE_CACHE_MAX_SZ || size > LARGE_CACHE_CAP
+        || LargeSizeCeiling(size) != size) {
+        return false;
+    }
+
+    size_t bytes = _bytes.fetch_add(size) + size;
+    PushBin(LargeCacheIdx(size), desc);
+
+    if (UNLIKELY(bytes > LARGE_CACHE_CAP)) {
+        Evict(LARGE_CACHE_CAP);
+    }
+
+    return true;
+}
+
+Descriptor* LargeCache::PopBin(size_t idx)
+{
+    std::atomic<DescriptorNode>& bin = _bins[idx];
+    DescriptorNode oldHead = bin.load();
+    DescriptorNode newHead;
+    do {
+        Descriptor* desc = oldHead.GetDesc();
+        if (!desc) {
+            return nullptr;
+        }
+
+        newHead = desc->nextFree.load();
+        newHead.Set(newHead.GetDesc(), oldHead.GetCounter());
+    } while (!bin.compare_exchange_weak(oldHead, newHead));
+
+    return oldHead.GetDesc();
+}
+
+void LargeCache::PushBin(size_t idx, Descriptor* desc)
+{
+    std::atomic<DescriptorNode>& bin = _bins[idx];
+    DescriptorNode oldHead = bin.load();
+    DescriptorNode newHead;
+    do {
+        desc->nextFree.store(oldHead);
+        newHead.Set(desc, oldHead.GetCounter() + 1);
+    } while (!bin.compare_exchange_weak(oldHead, newHead));
+}
+
+void LargeCache::Evict(size_t target)
+{
+    // largest mappings are the least likely to be reused soon
+    //  and release the most memory per munmap
+    for (size_t idx = LARGE_CACHE_BINS; idx-- > 0;) {
+        while (_bytes.load() > target) {
+            Descriptor* desc = PopBin(idx);
+            if (!desc) {
+                break;
+            }
+
+            _bytes.fetch_sub(desc->blockSize);
+
+            UnregisterDesc(nullptr, desc->superblock);
+            PageFree(desc->superblock, desc->blockSize);
+            DescRetire(desc);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#ifndef __LARGECACHE_H_
+#define __LARGECACHE_H_
+
+#include <atomic>
+
+#include "log.h"
+#include "lrmalloc.h"
+#include "lrmalloc_internal.h"
+
+// large allocations are rounded up to one of 4 sizes per power of two
+//  so that freed mappings can be reused by allocations of similar size
+// smallest size with a quarter-step of at least a page
+#define LG_LARGE_CACHE_MIN_SZ (LG_PAGE + 2)
+// largest size kept in the cache, larger mappings are always unmapped
+#define LG_LARGE_CACHE_MAX_SZ 25
+#define LARGE_CACHE_MAX_SZ (1ULL << LG_LARGE_CACHE_MAX_SZ)
+#define LARGE_CACHE_BINS (1 + (LG_LARGE_CACHE_MAX_SZ - LG_LARGE_CACHE_MIN_SZ) * 4)
+// max number of bytes retained by the cache, across all bins
+#define LARGE_CACHE_CAP (1ULL << 26)
+
+// index of bin that holds mappings of size LargeSizeCeiling(size)
+// size must be <= LARGE_CACHE_MAX_SZ
+inline size_t LargeCacheIdx(size_t size)
+{
+    if (size <= (1ULL << LG_LARGE_CACHE_MIN_SZ)) {
+        return 0;
+    }
+
+    // size in ]2^lg, 2^(lg + 1)]
+    size_t lg = 63 - __builtin_clzl(size - 1);
+    size_t lgDelta = lg - 2;
+    size_t ndelta = (size - (1ULL << lg) + (1ULL << lgDelta) - 1) >> lgDelta;
+    ASSERT(ndelta >= 1 && ndelta <= 4);
+    return 1 + (lg - LG_LARGE_CACHE_MIN_SZ) * 4 + (ndelta - 1);
+}
+
+inline size_t LargeCacheSize(size_t idx)
+{
+    if (idx == 0) {
+        return (1ULL << LG_LARGE_CACHE_MIN_SZ);
+    }
+
+    size_t lg = LG_LARGE_CACHE_MIN_SZ + (idx - 1) / 4;
+    size_t ndelta = 1 + (idx - 1) % 4;
+    return (1ULL << lg) + (ndelta << (lg - 2));
+}
+
+// returns size that large allocations of `size` bytes are mapped with
+// returns 0 if the page ceiling of `size` overflows
+inline size_t LargeSizeCeiling(size_t size)
+{
+    if (UNLIKELY(size > SIZE_MAX - PAGE + 1)) {
+        return 0;
+    }
+
+    if (size > LARGE_CACHE_MAX_SZ) {
+        return PAGE_CEILING(size);
+    }
+
+    return LargeCacheSize(LargeCacheIdx(size));
+}
+
+// cache of freed large allocations
+// cached descriptors keep their mapping and pagemap registration, so
+//  reusing one is a single list pop
+// each bin is a lock-free stack of descriptors, linked with nextFree
+struct LargeCache {
+private:
+    std::atomic<DescriptorNode> _bins[LARGE_CACHE_BINS];
+    // bytes currently retained by all bins
+    std::atomic<size_t> _bytes;
+
+public:
+    // returns a cached descriptor with blockSize == LargeSizeCeiling(size)
+    //  or nullptr if none is available
+    Descriptor* Alloc(size_t size);
+    // caches a large allocation descriptor, returns false if the
+    //  mapping can't be cached and must be released by the caller
+    bool Free(Descriptor* desc);
+
+private:
+    Descriptor* PopBin(size_t idx);
+    void PushBin(size_t idx, Descriptor* desc);
+    // release cached mappings, largest first, until at most
+    //  `target` bytes are retained
+    void Evict(size_t target);
+};
+
+extern LargeCache sLargeCache;
+
+#endif // __LARGECACHE_H_
@@ -13,41 +13,54 @@
 // for ENOMEM
 #include <errno.h>
 
+#include "arena.h"
+#include "largecache.h"
 #include "log.h"
 #include "lrmalloc.h"
 #include "lrmalloc_internal.h"
 #include "mapcache.h"
+#include "numa.h"
 #include "pagemap.h"
 #include "pages.h"
+#include "percpu.h"
+#include "prof.h"
+#include "remote.h"
 #include "size_classes.h"
+#include "stats.h"
 #include "tcache.h"
 
-// global variables
-// descriptor recycle list
-extern std::atomic<DescriptorNode> AvailDesc;
-
 // helper fns
 void HeapPushPartial(Descriptor* desc);
 Descriptor* HeapPopPartial(ProcHeap* heap);
-void MallocFromPartial(size_t scIdx, TCacheBin* cache, size_t& blockNum);
-void MallocFromNewSB(size_t scIdx, TCacheBin* cache, size_t& blockNum);
-Descriptor* DescAlloc();
-void DescRetire(Descriptor* desc);
+void MallocFromPartial(size_t scIdx, TCacheBin* cache, size_t& blockNum, ProcHeap* arenaHeap = nullptr);
+void MallocFromNewSB(size_t scIdx, TCacheBin* cache, size_t& blockNum, ProcHeap* arenaHeap = nullptr);
+void FreeList(size_t scIdx, Descriptor* desc, char* head, char* tail, uint32_t blockCount);
+#if LFMALLOC_REMOTE_FREE
+void MallocFromRemote(size_t scIdx, TCacheBin* cache, size_t& blockNum);
+#endif
+Descriptor* LargeAlloc(size_t size, bool& zeroed);
+void LargeFree(Descriptor* desc);
+void* LargeRealloc(Descriptor* desc, size_t size);
+#if LFMALLOC_PERCPU
+char* PerCpuFill(size_t scIdx);
+void PerCpuFlush(size_t scIdx, char* block);
+#endif
 
 // global variables
-// descriptor recycle list
-std::atomic<DescriptorNode> sAvailDesc({ nullptr });
+// descriptor recycle lists, one per descriptor kind
+std::atomic<DescriptorNode> sAvailDesc[DESC_KINDS];
 // malloc init state
 bool sMallocInit = false;
-// heaps, one heap per size class
-ProcHeap sHeaps[MAX_SZ_IDX];
+// heaps, one heap per numa node and size class
+ProcHeap sHeaps[NUMA_MAX_NODES][MAX_SZ_IDX];
 
 // (un)register descriptor pages with pagemap
 // all pages used by the descriptor will point to desc in
 //  the pagemap
 // for (unaligned) large allocations, only first page points to desc
 // aligned large allocations get the corresponding page pointing to desc
-void UpdatePageMap(ProcHeap* heap, char* ptr, Descriptor* desc, size_t scIdx)
+// returns false if out of memory, entries may be partially set
+bool UpdatePageMap(ProcHeap* heap, char* ptr, Descriptor* desc, size_t scIdx)
 {
     ASSERT(ptr);
 
@@ -57,24 +70,39 @@ void UpdatePageMap(ProcHeap* heap, char* ptr, Descriptor* desc, size_t scIdx)
     // large allocation, don't need to (un)register every page
     // just first
     if (!heap) {
-        sPageMap.SetPageInfo(ptr, info);
-        return;
+        return sPageMap.SetPageInfo(ptr, info);
     }
 
     // only need to worry about alignment for large allocations
     // ASSERT(ptr == superblock);
 
+    size_t sbSize = heap->GetSizeClass()->sbSize;
+#if LFMALLOC_SB_PAGEMAP
+    // small allocation, superblocks are aligned to their size and
+    //  sbSize is a multiple of SB_SIZE, one entry per SB_SIZE
+    ASSERT(((size_t)ptr & (sbSize - 1)) == 0);
+    ASSERT((sbSize & (SB_SIZE - 1)) == 0);
+    for (size_t idx = 0; idx < sbSize; idx += SB_SIZE) {
+        if (UNLIKELY(!sSbMap.SetPageInfo(ptr + idx, info))) {
+            return false;
+        }
+    }
+#else
     // small allocation, (un)register every page
     // could *technically* optimize if blockSize >>> page,
     //  but let's not worry about that
-    // SB_SIZE is a multiple of page
-    ASSERT((SB_SIZE & PAGE_MASK) == 0);
-    for (size_t idx = 0; idx < SB_SIZE; idx += PAGE) {
-        sPageMap.SetPageInfo(ptr + idx, info);
+    // sbSize is a multiple of page
+    ASSERT((sbSize & PAGE_MASK) == 0);
+    for (size_t idx = 0; idx < sbSize; idx += PAGE) {
+        if (UNLIKELY(!sPageMap.SetPageInfo(ptr + idx, info))) {
+            return false;
+        }
     }
+#endif
+    return true;
 }
 
-void RegisterDesc(Descriptor* desc)
+bool RegisterDesc(Descriptor* desc)
 {
     ProcHeap* heap = desc->heap;
     char* ptr = desc->superblock;
@@ -83,7 +111,13 @@ void RegisterDesc(Descriptor* desc)
         scIdx = heap->scIdx;
     }
 
-    UpdatePageMap(heap, ptr, desc, scIdx);
+    if (UNLIKELY(!UpdatePageMap(heap, ptr, desc, scIdx))) {
+        // clearing entries never fails
+        UnregisterDesc(heap, ptr);
+        return false;
+    }
+
+    return true;
 }
 
 // unregister descriptor before superblock deletion
@@ -96,6 +130,15 @@ void UnregisterDesc(ProcHeap* heap, char* superblock)
 LFMALLOC_INLINE
 PageInfo GetPageInfoForPtr(void* ptr)
 {
+#if LFMALLOC_SB_PAGEMAP
+    // small allocations are the common case, only large allocations
+    //  need the page-granular lookup
+    PageInfo info = sSbMap.GetPageInfo((char*)ptr);
+    if (LIKELY(info.GetDesc() != nullptr)) {
+        return info;
+    }
+#endif
+
     return sPageMap.GetPageInfo((char*)ptr);
 }
 
@@ -108,7 +151,7 @@ uint32_t ComputeIdx(char* superblock, char* block, size_t scIdx)
     (void)scBlockSize; // suppress unused var warning
 
     ASSERT(block >= superblock);
-    ASSERT(block < superblock + SB_SIZE);
+    ASSERT(block < superblock + sc->sbSize);
     // optimize integer division by allowing the compiler to create
     //  a jump table using size class index
     // compiler can then optimize integer div due to known divisor
@@ -141,12 +184,28 @@ SizeClassData* ProcHeap::GetSizeClass() const
     return &SizeClasses[scIdx];
 }
 
-Descriptor* ListPopPartial(ProcHeap* heap)
+// partial list shard of the calling thread
+// threads are assigned shards round-robin on first use
+static __thread uint32_t sPartialShard LFMALLOC_TLS_INIT_EXEC = 0;
+static std::atomic<uint32_t> sNextPartialShard({ 0 });
+
+LFMALLOC_INLINE
+uint32_t GetPartialShard()
+{
+    // 0 means unassigned, shards are stored 1-based
+    if (UNLIKELY(sPartialShard == 0)) {
+        sPartialShard = 1 + sNextPartialShard.fetch_add(1, std::memory_order_relaxed) % LFMALLOC_PARTIAL_SHARDS;
+    }
+
+    return sPartialShard - 1;
+}
+
+Descriptor* ListPopPartial(std::atomic<DescriptorNode>& list)
 {
-    std::atomic<DescriptorNode>& list = heap->partialList;
+    Backoff backoff;
     DescriptorNode oldHead = list.load();
     DescriptorNode newHead;
-    do {
+    while (true) {
         Descriptor* oldDesc = oldHead.GetDesc();
         if (!oldDesc) {
             return nullptr;
@@ -156,40 +215,78 @@ Descriptor* ListPopPartial(ProcHeap* heap)
         Descriptor* desc = newHead.GetDesc();
         uint64_t counter = oldHead.GetCounter();
         newHead.Set(desc, counter);
-    } while (!list.compare_exchange_weak(oldHead, newHead));
+        if (list.compare_exchange_weak(oldHead, newHead)) {
+            break;
+        }
+
+        backoff.Pause();
+    }
 
     return oldHead.GetDesc();
 }
 
-void ListPushPartial(Descriptor* desc)
+void ListPushPartial(std::atomic<DescriptorNode>& list, Descriptor* desc)
 {
-    ProcHeap* heap = desc->heap;
-    std::atomic<DescriptorNode>& list = heap->partialList;
-
+    Backoff backoff;
     DescriptorNode oldHead = list.load();
     DescriptorNode newHead;
-    do {
+    while (true) {
         newHead.Set(desc, oldHead.GetCounter() + 1);
         ASSERT(oldHead.GetDesc() != newHead.GetDesc());
         newHead.GetDesc()->nextPartial.store(oldHead);
-    } while (!list.compare_exchange_weak(oldHead, newHead));
+        if (list.compare_exchange_weak(oldHead, newHead)) {
+            break;
+        }
+
+        backoff.Pause();
+    }
 }
 
 void HeapPushPartial(Descriptor* desc)
 {
-    ListPushPartial(desc);
+    ProcHeap* heap = desc->heap;
+    STATS_ADD(bins[heap->scIdx].partialPushes, 1);
+    ListPushPartial(heap->partialList[GetPartialShard()].head, desc);
 }
 
 Descriptor* HeapPopPartial(ProcHeap* heap)
 {
-    return ListPopPartial(heap);
+    // own shard first, then steal from the others
+    uint32_t shard = GetPartialShard();
+    for (uint32_t idx = 0; idx < LFMALLOC_PARTIAL_SHARDS; ++idx) {
+        PartialList& list = heap->partialList[(shard + idx) % LFMALLOC_PARTIAL_SHARDS];
+        // skip empty shards without a CAS
+        if (list.head.load().GetDesc() == nullptr) {
+            continue;
+        }
+
+        Descriptor* desc = ListPopPartial(list.head);
+        if (desc) {
+            STATS_ADD(bins[heap->scIdx].partialPops, 1);
+            return desc;
+        }
+    }
+
+    return nullptr;
 }
 
-void MallocFromPartial(size_t scIdx, TCacheBin* cache, size_t& blockNum)
+// `arenaHeap` is the heap of an arena to take blocks from, instead of the
+//  process heaps
+void MallocFromPartial(size_t scIdx, TCacheBin* cache, size_t& blockNum, ProcHeap* arenaHeap)
 {
-    ProcHeap* heap = &sHeaps[scIdx];
+    Descriptor* desc;
+    if (arenaHeap) {
+        desc = HeapPopPartial(arenaHeap);
+    } else {
+        uint32_t node = GetNumaIdx(GetNumaNode());
+        desc = HeapPopPartial(&sHeaps[node][scIdx]);
+        // remote memory is still better than mapping a new superblock
+        //  while others are partially used
+        for (uint32_t idx = 1; !desc && idx < sNumaNodes; ++idx) {
+            desc = HeapPopPartial(&sHeaps[(node + idx) % sNumaNodes][scIdx]);
+        }
+    }
 
-    Descriptor* desc = HeapPopPartial(heap);
     if (!desc) {
         return;
     }
@@ -204,7 +301,9 @@ void MallocFromPartial(size_t scIdx, TCacheBin* cache, size_t& blockNum)
     // we have "ownership" of block, but anchor can still change
     // due to free()
     do {
-        if (oldAnchor.state == SB_EMPTY) {
+        // empty superblocks of arenas are kept, all their blocks are
+        //  available
+        if (oldAnchor.state == SB_EMPTY && !arenaHeap) {
             DescRetire(desc);
             // retry
             return MallocFromPartial(scIdx, cache, blockNum);
@@ -214,7 +313,7 @@ void MallocFromPartial(size_t scIdx, TCacheBin* cache, size_t& blockNum)
         // can't be SB_FULL because we *own* the block now
         // and it came from HeapPopPartial
         // can't be SB_EMPTY, we already checked
-        ASSERT(oldAnchor.state == SB_PARTIAL);
+        ASSERT(oldAnchor.state == SB_PARTIAL || arenaHeap);
 
         newAnchor = oldAnchor;
         newAnchor.count = 0;
@@ -223,392 +322,1132 @@ void MallocFromPartial(size_t scIdx, TCacheBin* cache, size_t& blockNum)
         newAnchor.state = SB_FULL;
     } while (!desc->anchor.compare_exchange_weak(oldAnchor, newAnchor));
 
+#if LFMALLOC_REMOTE_FREE
+    desc->owner = sRemoteInbox;
+#endif
+
     // will take as many blocks as available from superblock
     // *AND* no thread can do malloc() using this superblock, we
     //  exclusively own it
     // if CAS fails, it just means another thread added more available blocks
     //  through FlushCache, which we can then use
-    uint32_t blocksTaken = oldAnchor.count;
+    // an empty superblock's count is one short, see FreeList
+    uint32_t blocksTaken = oldAnchor.state == SB_EMPTY ? maxcount : oldAnchor.count;
     uint32_t avail = oldAnchor.avail;
 
     ASSERT(avail < maxcount);
     char* block = superblock + avail * blockSize;
 
+    // blocks beyond cache limit go back to the superblock
+    // we own all taken blocks, so walking their links is safe
+    uint32_t limit = cache->GetLimit();
+    if (blocksTaken > limit) {
+        char* rest = block;
+        for (uint32_t idx = 0; idx < limit; ++idx) {
+            rest += *(ptrdiff_t*)rest + blockSize;
+        }
+
+        FreeList(scIdx, desc, rest, nullptr, blocksTaken - limit);
+        blocksTaken = limit;
+    }
+
     // cache must be empty at this point
     // and the blocks are already organized as a list
     // so all we need do is "push" that list, a constant time op
     ASSERT(cache->GetBlockNum() == 0);
-    cache->PushList(block, blocksTaken);
+    cache->PushList(block, blocksTaken, false);
 
     blockNum += blocksTaken;
 }
 
-void MallocFromNewSB(size_t scIdx, TCacheBin* cache, size_t& blockNum)
+// blockNum is left unchanged if out of memory
+void MallocFromNewSB(size_t scIdx, TCacheBin* cache, size_t& blockNum, ProcHeap* arenaHeap)
 {
-    ProcHeap* heap = &sHeaps[scIdx];
+    ProcHeap* heap = arenaHeap;
+    uint32_t node;
+    if (heap) {
+        node = heap->node;
+    } else {
+        // heaps can be shared by several nodes, superblock is bound to
+        //  the node of the calling thread
+        node = GetNumaNode();
+        heap = &sHeaps[GetNumaIdx(node)][scIdx];
+    }
+
     SizeClassData* sc = &SizeClasses[scIdx];
 
-    Descriptor* desc = DescAlloc();
-    ASSERT(desc);
+    Descriptor* desc = DescAlloc(DESC_SUPERBLOCK);
+    if (UNLIKELY(desc == nullptr)) {
+        return;
+    }
 
     uint32_t const blockSize = sc->blockSize;
     uint32_t const maxcount = sc->GetBlockNum();
 
+    STATS_ADD(bins[scIdx].sbAllocs, 1);
     desc->heap = heap;
     desc->blockSize = blockSize;
     desc->maxcount = maxcount;
-    desc->superblock = sMapCache.Alloc();
+#if LFMALLOC_REMOTE_FREE
+    desc->owner = sRemoteInbox;
+#endif
+    bool zeroed;
+    char* superblock = sMapCache.Alloc(sc->sbSize, node, zeroed);
+    if (UNLIKELY(superblock == nullptr)) {
+        DescRetire(desc);
+        return;
+    }
+
+    desc->superblock = superblock;
+
+    // register new descriptor
+    // must be done before setting superblock as active
+    // or leaving superblock as available in a partial list
+    if (UNLIKELY(!RegisterDesc(desc))) {
+        sMapCache.Free(superblock, sc->sbSize, node);
+        DescRetire(desc);
+        return;
+    }
+
+    // zero-filled blocks are a valid list, each block points to
+    //  the next one
+    // reused superblocks need that list rebuilt
+    if (!zeroed) {
+        for (uint32_t idx = 0; idx < maxcount; ++idx) {
+            *(ptrdiff_t*)(superblock + idx * blockSize) = 0;
+        }
+    }
 
-    cache->PushList(desc->superblock, maxcount);
+    // take at most cache limit blocks, the rest are left available
+    //  in the superblock
+    uint32_t const blocksTaken = std::min(maxcount, cache->GetLimit());
+    cache->PushList(superblock, blocksTaken, zeroed);
 
     Anchor anchor;
     anchor.avail = maxcount;
     anchor.count = 0;
     anchor.state = SB_FULL;
+    if (blocksTaken < maxcount) {
+        anchor.avail = blocksTaken;
+        anchor.count = maxcount - blocksTaken;
+        anchor.state = SB_PARTIAL;
+    }
 
     desc->anchor.store(anchor);
 
     ASSERT(anchor.avail < maxcount || anchor.state == SB_FULL);
     ASSERT(anchor.count < maxcount);
 
-    // register new descriptor
-    // must be done before setting superblock as active
-    // or leaving superblock as available in a partial list
-    RegisterDesc(desc);
+    if (arenaHeap) {
+        arenaHeap->arena->Track(arenaHeap->arena->superblocks, desc);
+    }
 
     // if state changes to SB_PARTIAL, desc must be added to partial list
-    ASSERT(anchor.state == SB_FULL);
+    if (anchor.state == SB_PARTIAL) {
+        HeapPushPartial(desc);
+    }
+
+    blockNum += blocksTaken;
+}
+
+#if LFMALLOC_REMOTE_FREE
+// take blocks other threads freed into superblocks owned by the thread
+void MallocFromRemote(size_t scIdx, TCacheBin* cache, size_t& blockNum)
+{
+    RemoteInbox* inbox = GetRemoteInbox();
+    if (UNLIKELY(inbox == nullptr)) {
+        return;
+    }
+
+    uint32_t count;
+    char* block = inbox->Drain(scIdx, count);
+    if (count == 0) {
+        return;
+    }
+
+    // cache must be empty at this point
+    ASSERT(cache->GetBlockNum() == 0);
+    cache->PushList(block, count, false);
+
+    // blocks beyond cache limit go back to their superblocks
+    uint32_t limit = cache->GetLimit();
+    if (count > limit) {
+        FlushCache(scIdx, cache, count - limit);
+    }
+
+    blockNum += cache->GetBlockNum();
+}
+#endif
+
+// purged descriptor blocks, linked through DescChunk::next
+// blocks are DESCRIPTOR_BLOCK_SZ aligned, low bits hold an aba counter
+std::atomic<uint64_t> sPurgedDescChunks({ 0 });
+// descriptors handed out by DescAlloc and not yet retired
+std::atomic<size_t> sDescActive({ 0 });
+// descriptor bytes not purged
+std::atomic<size_t> sDescResident({ 0 });
+// descriptors in descriptor blocks not purged
+std::atomic<size_t> sDescTotal({ 0 });
+// descriptors retired since last reclaim pass
+std::atomic<size_t> sDescRetires({ 0 });
+// retired descriptors needed to trigger next reclaim pass
+std::atomic<size_t> sDescReclaimAt({ DESC_RECLAIM_RETIRES });
+// set while a reclaim pass runs, passes are skipped instead of waited for
+std::atomic<bool> sDescReclaiming({ false });
+
+#define DESC_CHUNK_MASK (DESCRIPTOR_BLOCK_SZ - 1)
+
+LFMALLOC_INLINE
+DescChunk* GetDescChunk(Descriptor* desc)
+{
+    return (DescChunk*)((size_t)desc & ~DESC_CHUNK_MASK);
+}
+
+void PushPurgedDescChunk(DescChunk* chunk)
+{
+    uint64_t oldHead = sPurgedDescChunks.load();
+    uint64_t newHead;
+    do {
+        chunk->next.store(oldHead);
+        newHead = (uint64_t)chunk | ((oldHead + 1) & DESC_CHUNK_MASK);
+    } while (!sPurgedDescChunks.compare_exchange_weak(oldHead, newHead));
+}
+
+DescChunk* PopPurgedDescChunk()
+{
+    uint64_t oldHead = sPurgedDescChunks.load();
+    uint64_t newHead;
+    do {
+        DescChunk* chunk = (DescChunk*)(oldHead & ~DESC_CHUNK_MASK);
+        if (!chunk) {
+            return nullptr;
+        }
 
-    blockNum += maxcount;
+        // header page is never purged, safe to read even if stale
+        newHead = (chunk->next.load() & ~DESC_CHUNK_MASK) | (oldHead & DESC_CHUNK_MASK);
+    } while (!sPurgedDescChunks.compare_exchange_weak(oldHead, newHead));
+
+    return (DescChunk*)(oldHead & ~DESC_CHUNK_MASK);
+}
+
+// add a list of descriptors to available descriptors
+void PushAvailDescs(std::atomic<DescriptorNode>& list, Descriptor* first, Descriptor* last)
+{
+    DescriptorNode oldHead = list.load();
+    DescriptorNode newHead;
+    do {
+        last->nextFree.store(oldHead);
+        newHead.Set(first, oldHead.GetCounter() + 1);
+    } while (!list.compare_exchange_weak(oldHead, newHead));
 }
 
-Descriptor* DescAlloc()
+Descriptor* DescAlloc(DescKind kind)
 {
-    DescriptorNode oldHead = sAvailDesc.load();
+    std::atomic<DescriptorNode>& list = sAvailDesc[kind];
+    DescriptorNode oldHead = list.load();
     while (true) {
         Descriptor* desc = oldHead.GetDesc();
         if (desc) {
             DescriptorNode newHead = desc->nextFree.load();
             newHead.Set(newHead.GetDesc(), oldHead.GetCounter());
-            if (sAvailDesc.compare_exchange_weak(oldHead, newHead)) {
+            if (list.compare_exchange_weak(oldHead, newHead)) {
                 ASSERT(desc->blockSize == 0);
+                GetDescChunk(desc)->active.fetch_add(1, std::memory_order_relaxed);
+                sDescActive.fetch_add(1, std::memory_order_relaxed);
                 return desc;
             }
         } else {
-            // allocate several pages
+            // reuse a purged block if any, pages fault back in as needed
+            // otherwise allocate several pages
+            char* ptr = (char*)PopPurgedDescChunk();
+            if (ptr) {
+                sDescResident.fetch_add(DESCRIPTOR_BLOCK_SZ - PAGE, std::memory_order_relaxed);
+            } else {
+                // aligned, so that descriptors can find their block
+                ptr = (char*)PageAllocAligned(DESCRIPTOR_BLOCK_SZ, DESCRIPTOR_BLOCK_SZ);
+                if (UNLIKELY(ptr == nullptr)) {
+                    return nullptr;
+                }
+
+                sDescResident.fetch_add(DESCRIPTOR_BLOCK_SZ, std::memory_order_relaxed);
+            }
+
+            sDescTotal.fetch_add(DESC_CHUNK_NUM, std::memory_order_relaxed);
+            sDescActive.fetch_add(1, std::memory_order_relaxed);
+
+            DescChunk* chunk = (DescChunk*)ptr;
+            chunk->kind = kind;
+            chunk->reclaimNum = 0;
+            chunk->active.store(1, std::memory_order_relaxed);
+
             // get first descriptor, this is returned to caller
-            char* ptr = (char*)PageAlloc(DESCRIPTOR_BLOCK_SZ);
-            Descriptor* ret = (Descriptor*)ptr;
+            Descriptor* descs = (Descriptor*)(ptr + sizeof(DescChunk));
+            Descriptor* ret = &descs[0];
+            ret->blockSize = 0;
             // organize list with the rest of descriptors
             // and add to available descriptors
-            {
-                Descriptor* first = nullptr;
-                Descriptor* prev = nullptr;
-
-                char* currPtr = ptr + sizeof(Descriptor);
-                currPtr = ALIGN_ADDR(currPtr, CACHELINE);
-                first = (Descriptor*)currPtr;
-                while (currPtr + sizeof(Descriptor) < ptr + DESCRIPTOR_BLOCK_SZ) {
-                    Descriptor* curr = (Descriptor*)currPtr;
-                    if (prev) {
-                        prev->nextFree.store({ curr });
-                    }
-
-                    prev = curr;
-                    currPtr = currPtr + sizeof(Descriptor);
-                    currPtr = ALIGN_ADDR(currPtr, CACHELINE);
+            for (size_t idx = 1; idx < DESC_CHUNK_NUM; ++idx) {
+                descs[idx].blockSize = 0;
+                if (idx + 1 < DESC_CHUNK_NUM) {
+                    descs[idx].nextFree.store({ &descs[idx + 1] });
                 }
-
-                prev->nextFree.store({ nullptr });
-
-                // add list to available descriptors
-                DescriptorNode oldHead = sAvailDesc.load();
-                DescriptorNode newHead;
-                do {
-                    prev->nextFree.store(oldHead);
-                    newHead.Set(first, oldHead.GetCounter() + 1);
-                } while (!sAvailDesc.compare_exchange_weak(oldHead, newHead));
             }
 
+            PushAvailDescs(list, &descs[1], &descs[DESC_CHUNK_NUM - 1]);
             return ret;
         }
     }
 }
 
-void DescRetire(Descriptor* desc)
+// purge blocks whose descriptors are all in `list`
+// returns number of descriptors left in `list`
+size_t DescReclaimList(std::atomic<DescriptorNode>& list)
 {
-    desc->blockSize = 0;
-    DescriptorNode oldHead = sAvailDesc.load();
+    // take all available descriptors, so that none of them can be
+    //  handed out while the pass runs
+    // concurrent DescAlloc calls allocate new blocks in the meantime
+    DescriptorNode oldHead = list.load();
     DescriptorNode newHead;
     do {
-        desc->nextFree.store(oldHead);
-
-        newHead.Set(desc, oldHead.GetCounter() + 1);
-    } while (!sAvailDesc.compare_exchange_weak(oldHead, newHead));
-}
+        newHead.Set(nullptr, oldHead.GetCounter() + 1);
+    } while (!list.compare_exchange_weak(oldHead, newHead));
 
-void FillCache(size_t scIdx, TCacheBin* cache)
-{
-    // at most cache will be filled with number of blocks equal to superblock
-    size_t blockNum = 0;
-    // use a *SINGLE* partial superblock to try to fill cache
-    MallocFromPartial(scIdx, cache, blockNum);
-    // if we obtain no blocks from partial superblocks, create a new superblock
-    if (blockNum == 0) {
-        MallocFromNewSB(scIdx, cache, blockNum);
+    // count available descriptors per block
+    for (Descriptor* desc = oldHead.GetDesc(); desc; desc = desc->nextFree.load().GetDesc()) {
+        GetDescChunk(desc)->reclaimNum++;
     }
 
-    SizeClassData* sc = &SizeClasses[scIdx];
-    (void)sc;
-    ASSERT(blockNum > 0);
-    ASSERT(blockNum <= sc->cacheBlockNum);
-}
-
-void FlushCache(size_t scIdx, TCacheBin* cache)
-{
-    ProcHeap* heap = &sHeaps[scIdx];
-    SizeClassData* sc = &SizeClasses[scIdx];
-    uint32_t const blockSize = sc->blockSize;
-    // after CAS, desc might become empty and
-    //  concurrently reused, so store maxcount
-    uint32_t const maxcount = sc->GetBlockNum();
-    (void)maxcount; // suppress unused warning
-
-    // @todo: optimize
-    // in the normal case, we should be able to return several
-    //  blocks with a single CAS
-    while (cache->GetBlockNum() > 0) {
-        char* head = cache->PeekBlock();
-        char* tail = head;
-        PageInfo info = GetPageInfoForPtr(head);
-        Descriptor* desc = info.GetDesc();
-        char* superblock = desc->superblock;
-
-        // cache is a linked list of blocks
-        // superblock free list is also a linked list of blocks
-        // can optimize transfers of blocks between these 2 entities
-        //  by exploiting existing structure
-        uint32_t blockCount = 1;
-        // check if next cache blocks are in the same superblock
-        // same superblock, same descriptor
-        while (cache->GetBlockNum() > blockCount) {
-            char* ptr = tail + *(ptrdiff_t*)tail + blockSize;
-            if (ptr < superblock || ptr >= superblock + SB_SIZE) {
-                break; // ptr not in superblock
+    // blocks with all descriptors available are purged, the descriptors
+    //  of the others are added back
+    // purging must wait until the list is no longer walked
+    DescChunk* purged = nullptr;
+    Descriptor* first = nullptr;
+    Descriptor* last = nullptr;
+    size_t kept = 0;
+    Descriptor* desc = oldHead.GetDesc();
+    while (desc) {
+        Descriptor* next = desc->nextFree.load().GetDesc();
+        DescChunk* chunk = GetDescChunk(desc);
+        if (chunk->reclaimNum == DESC_CHUNK_NUM) {
+            // first descriptor found of the block, mark block as done
+            chunk->reclaimNum = DESC_CHUNK_NUM + 1;
+            chunk->next.store((uint64_t)purged);
+            purged = chunk;
+        } else if (chunk->reclaimNum < DESC_CHUNK_NUM) {
+            chunk->reclaimNum = 0;
+            if (last) {
+                last->nextFree.store({ desc });
+            } else {
+                first = desc;
             }
 
-            // ptr in superblock, add to "list"
-            ++blockCount;
-            tail = ptr;
+            last = desc;
+            kept++;
         }
 
-        cache->PopList(tail + *(ptrdiff_t*)tail + blockSize, blockCount);
+        desc = next;
+    }
 
-        // add list to desc, update anchor
-        uint32_t idx = ComputeIdx(superblock, head, scIdx);
+    if (first) {
+        PushAvailDescs(list, first, last);
+    }
 
-        Anchor oldAnchor = desc->anchor.load();
-        Anchor newAnchor;
-        do {
-            // update anchor.avail
-            char* next = (char*)(superblock + oldAnchor.avail * blockSize);
-            *(ptrdiff_t*)tail = next - tail - blockSize;
+    while (purged) {
+        DescChunk* next = (DescChunk*)purged->next.load();
+        // header page holds the purged list link
+        PagePurge((char*)purged + PAGE, DESCRIPTOR_BLOCK_SZ - PAGE);
+        sDescResident.fetch_sub(DESCRIPTOR_BLOCK_SZ - PAGE, std::memory_order_relaxed);
+        sDescTotal.fetch_sub(DESC_CHUNK_NUM, std::memory_order_relaxed);
+        PushPurgedDescChunk(purged);
+        purged = next;
+    }
 
-            newAnchor = oldAnchor;
-            newAnchor.avail = idx;
-            // state updates
-            if (oldAnchor.state == SB_FULL) {
-                newAnchor.state = SB_PARTIAL;
-            }
+    return kept;
+}
 
-            ASSERT(oldAnchor.count < desc->maxcount);
-            if (oldAnchor.count + blockCount == desc->maxcount) {
-                newAnchor.count = desc->maxcount - 1;
-                newAnchor.state = SB_EMPTY; // can free superblock
-            } else {
-                newAnchor.count += blockCount;
-            }
-        } while (!desc->anchor.compare_exchange_weak(oldAnchor, newAnchor));
-
-        // after last CAS, can't reliably read any desc fields
-        // as desc might have become empty and been concurrently reused
-        ASSERT(oldAnchor.avail < maxcount || oldAnchor.state == SB_FULL);
-        ASSERT(newAnchor.avail < maxcount);
-        ASSERT(newAnchor.count < maxcount);
-
-        // CAS success, can free block
-        if (newAnchor.state == SB_EMPTY) {
-            // unregister descriptor
-            UnregisterDesc(heap, superblock);
-
-            // free superblock
-            sMapCache.Free(superblock);
-        } else if (oldAnchor.state == SB_FULL) {
-            HeapPushPartial(desc);
+void DescRetire(Descriptor* desc)
+{
+    desc->blockSize = 0;
+    DescChunk* chunk = GetDescChunk(desc);
+    // count before the push, the descriptor can be handed out again
+    //  right after
+    bool emptied = chunk->active.fetch_sub(1, std::memory_order_relaxed) == 1;
+    PushAvailDescs(sAvailDesc[chunk->kind], desc, desc);
+
+    size_t active = sDescActive.fetch_sub(1, std::memory_order_relaxed) - 1;
+    size_t retires = sDescRetires.fetch_add(1, std::memory_order_relaxed) + 1;
+    // a chunk with no active descriptors left can be purged, e.g at the
+    //  end of a spike, so a pass doesn't wait for more retires that may
+    //  never come
+    // unless that leaves less than a chunk of spare descriptors, which
+    //  would purge and fault back the same chunk as descriptors come
+    //  and go
+    size_t total = sDescTotal.load(std::memory_order_relaxed);
+    bool due = retires >= sDescReclaimAt.load(std::memory_order_relaxed);
+    if (UNLIKELY(emptied) && total >= active + 2 * DESC_CHUNK_NUM) {
+        due = true;
+    }
+
+    if (UNLIKELY(due)) {
+        // only worth a pass if most descriptors are available
+        if (total > 2 * active) {
+            DescReclaim();
         }
     }
 }
 
-void InitMalloc()
+void DescReclaim()
 {
-    LOG_DEBUG();
-
-    // hard assumption that this can't be called concurrently
-    sMallocInit = true;
-
-    // init size classes
-    InitSizeClass();
+    if (sDescReclaiming.exchange(true)) {
+        return;
+    }
 
-    // init page map
-    sPageMap.Init();
+    sDescRetires.store(0, std::memory_order_relaxed);
 
-    // init heaps
-    for (size_t idx = 0; idx < MAX_SZ_IDX; ++idx) {
-        ProcHeap& heap = sHeaps[idx];
-        heap.partialList.store({ nullptr });
-        heap.scIdx = idx;
+    size_t kept = 0;
+    for (std::atomic<DescriptorNode>& list : sAvailDesc) {
+        kept += DescReclaimList(list);
     }
+
+    // cost of a pass is proportional to descriptors left available
+    sDescReclaimAt.store(std::max<size_t>(kept, DESC_RECLAIM_RETIRES), std::memory_order_relaxed);
+    sDescReclaiming.store(false);
 }
 
-LFMALLOC_INLINE
-void* do_malloc(size_t size)
+// allocate a large block with its own mapping
+// block size is rounded up so that the mapping can be cached once freed
+// `zeroed` is set if the block comes zero-filled from the OS
+Descriptor* LargeAlloc(size_t size, bool& zeroed)
 {
-    // ensure malloc is initialized
-    if (UNLIKELY(!sMallocInit)) {
-        InitMalloc();
+    size_t pages = LargeSizeCeiling(size);
+    if (UNLIKELY(pages == 0)) {
+        errno = ENOMEM;
+        return nullptr;
     }
 
-    // large block allocation
-    if (UNLIKELY(size > MAX_SZ)) {
-        size_t pages = PAGE_CEILING(size);
-        Descriptor* desc = DescAlloc();
-        ASSERT(desc);
+    STATS_ADD(largeAllocs, 1);
+    STATS_ADD(largeAllocBytes, pages);
 
-        desc->heap = nullptr;
-        desc->blockSize = pages;
-        desc->maxcount = 1;
-        desc->superblock = (char*)PageAlloc(pages);
+    // cached descriptors are still registered in the pagemap
+    Descriptor* desc = sLargeCache.Alloc(pages);
+    if (desc) {
+        zeroed = false;
+        return desc;
+    }
 
-        Anchor anchor;
-        anchor.avail = 0;
-        anchor.count = 0;
-        anchor.state = SB_FULL;
+    char* ptr = (char*)PageAllocHuge(pages, PAGE);
+    if (UNLIKELY(ptr == nullptr)) {
+        return nullptr;
+    }
 
-        desc->anchor.store(anchor);
+    desc = DescAlloc(DESC_LARGE);
+    if (UNLIKELY(desc == nullptr)) {
+        PageFree(ptr, pages);
+        return nullptr;
+    }
 
-        RegisterDesc(desc);
+    desc->heap = nullptr;
+    desc->blockSize = pages;
+    desc->maxcount = 1;
+    desc->superblock = ptr;
 
-        char* ptr = desc->superblock;
-        LOG_DEBUG("large, ptr: %p", ptr);
-        return (void*)ptr;
-    }
+    Anchor anchor;
+    anchor.avail = 0;
+    anchor.count = 0;
+    anchor.state = SB_FULL;
 
-    // size class calculation
-    size_t scIdx = GetSizeClass(size);
+    desc->anchor.store(anchor);
 
-    TCacheBin* cache = &TCache[scIdx];
-    // fill cache if needed
-    if (UNLIKELY(cache->GetBlockNum() == 0)) {
-        FillCache(scIdx, cache);
+    if (UNLIKELY(!RegisterDesc(desc))) {
+        PageFree(ptr, pages);
+        DescRetire(desc);
+        return nullptr;
     }
 
-    return cache->PopBlock(scIdx);
+    zeroed = true;
+    return desc;
 }
 
-LFMALLOC_INLINE
-bool isPowerOfTwo(size_t x)
+void LargeFree(Descriptor* desc)
 {
-    // https://stackoverflow.com/questions/3638431/determine-if-an-int-is-a-power-of-2-or-not-in-a-single-line
-    return x && !(x & (x - 1));
+    STATS_ADD(largeFrees, 1);
+    STATS_ADD(largeFreeBytes, desc->blockSize);
+
+    // keep mapping, descriptor and pagemap entry for reuse
+    if (sLargeCache.Free(desc)) {
+        return;
+    }
+
+    char* superblock = desc->superblock;
+
+    // unregister descriptor
+    UnregisterDesc(nullptr, superblock);
+
+    // free superblock
+    PageFree(superblock, desc->blockSize);
+
+    // desc cannot be in any partial list, so it can be
+    //  immediately reused
+    DescRetire(desc);
 }
 
-LFMALLOC_INLINE
-void* do_aligned_alloc(size_t alignment, size_t size)
+// resize a (non-aligned) large block in place
+// growing uses mremap, which can move the mapping but never copies data
+// shrinking releases tail pages
+// returns nullptr if the block can't be resized, leaving it untouched
+void* LargeRealloc(Descriptor* desc, size_t size)
 {
-    if (UNLIKELY(!isPowerOfTwo(alignment))) {
+    char* superblock = desc->superblock;
+    size_t oldSize = desc->blockSize;
+    size_t newSize = LargeSizeCeiling(size);
+    if (UNLIKELY(newSize == 0)) {
+        // original block is left untouched
+        errno = ENOMEM;
         return nullptr;
     }
 
-    size = ALIGN_VAL(size, alignment);
-
-    ASSERT(size > 0 && alignment > 0 && size >= alignment);
+    if (newSize == oldSize) {
+        return superblock;
+    }
 
-    // @todo: almost equal logic to do_malloc, DRY
-    // ensure malloc is initialized
-    if (UNLIKELY(!sMallocInit)) {
-        InitMalloc();
+    if (newSize < oldSize) {
+        STATS_ADD(largeFreeBytes, oldSize - newSize);
+        PageFree(superblock + newSize, oldSize - newSize);
+        desc->blockSize = newSize;
+        return superblock;
     }
 
-    // allocations smaller than PAGE will be correctly aligned
-    // this is because size >= alignment, and size will map to a small class
-    // size with the formula 2^X + A*2^(X-1) + C*2^(X-2)
-    // since size is a multiple of alignment, the lowest size class power of
-    // two is already >= alignment
-    // this does not work if allocation > PAGE even if it's a small class size,
-    // because the superblock for those allocations is only guaranteed
-    // to be page aligned
-    // force such allocations to become large block allocs
-    if (UNLIKELY(size > PAGE)) {
-        // hotfix solution for this case is to force allocation to be large
-        size = std::max<size_t>(size, MAX_SZ + 1);
+    // pagemap entry of first page stays the same
+    if (PageGrow(superblock, oldSize, newSize)) {
+        STATS_ADD(largeAllocBytes, newSize - oldSize);
+        desc->blockSize = newSize;
+        return superblock;
+    }
 
-        // large blocks are page-aligned
-        // if user asks for a diabolical alignment, need more pages to
-        // fulfil it
-        bool const needsMorePages = (alignment > PAGE);
-        if (UNLIKELY(needsMorePages)) {
-            size += alignment;
-        }
+    // block is registered at its destination before it moves, since
+    //  registering can fail
+    char* ptr = (char*)PageAllocHuge(newSize, PAGE);
+    if (UNLIKELY(ptr == nullptr)) {
+        return nullptr;
+    }
 
-        size_t pages = PAGE_CEILING(size);
-        Descriptor* desc = DescAlloc();
-        ASSERT(desc);
+    desc->superblock = ptr;
+    if (UNLIKELY(!RegisterDesc(desc))) {
+        desc->superblock = superblock;
+        PageFree(ptr, newSize);
+        return nullptr;
+    }
 
-        char* ptr = (char*)PageAlloc(pages);
+    // old pages can be reused by another mapping as soon as they are
+    //  remapped, so must unregister before mremap
+    UnregisterDesc(nullptr, superblock);
 
-        desc->heap = nullptr;
-        desc->blockSize = pages;
-        desc->maxcount = 1;
-        desc->superblock = ptr;
+    if (UNLIKELY(!PageMove(superblock, oldSize, ptr, newSize))) {
+        // original block is left untouched, and its pagemap entry can't
+        //  need new nodes
+        UnregisterDesc(nullptr, ptr);
+        PageFree(ptr, newSize);
+        desc->superblock = superblock;
+        RegisterDesc(desc);
+        errno = ENOMEM;
+        return nullptr;
+    }
 
-        Anchor anchor;
-        anchor.avail = 0;
-        anchor.count = 0;
-        anchor.state = SB_FULL;
+    STATS_ADD(largeAllocBytes, newSize - oldSize);
+    desc->blockSize = newSize;
 
-        desc->anchor.store(anchor);
+    LOG_DEBUG("large, ptr: %p -> %p", superblock, ptr);
+    return ptr;
+}
 
-        RegisterDesc(desc);
+bool FillCache(size_t scIdx, TCacheBin* cache)
+{
+#if LFMALLOC_STATS
+    InitThreadStats();
+#endif
+    STATS_ADD(bins[scIdx].fills, 1);
+
+    // bin limit grows with repeated fills
+    cache->Grow(scIdx);
+
+    // at most cache will be filled with number of blocks equal to limit
+    size_t blockNum = 0;
+#if LFMALLOC_REMOTE_FREE
+    // blocks other threads freed into our superblocks come first
+    MallocFromRemote(scIdx, cache, blockNum);
+    if (blockNum == 0) {
+        MallocFromPartial(scIdx, cache, blockNum);
+    }
+#else
+    // use a *SINGLE* partial superblock to try to fill cache
+    MallocFromPartial(scIdx, cache, blockNum);
+#endif
+    // if we obtain no blocks from partial superblocks, create a new superblock
+    if (blockNum == 0) {
+        MallocFromNewSB(scIdx, cache, blockNum);
+        if (UNLIKELY(blockNum == 0)) {
+            return false;
+        }
+    }
+
+    SizeClassData* sc = &SizeClasses[scIdx];
+    (void)sc;
+    ASSERT(blockNum <= cache->GetLimit());
+    ASSERT(blockNum <= sc->cacheBlockNum);
+
+    // amortized purging of retained superblocks
+    sMapCache.Decay();
+    return true;
+}
+
+void FlushCache(size_t scIdx, TCacheBin* cache, uint32_t blockNum)
+{
+#if LFMALLOC_STATS
+    InitThreadStats();
+#endif
+    STATS_ADD(bins[scIdx].flushes, 1);
+
+    SizeClassData* sc = &SizeClasses[scIdx];
+    uint32_t const blockSize = sc->blockSize;
+
+    // blocks are taken off the top of the cache list, reaching the
+    //  oldest ones would mean walking past all the kept ones
+    // cache blocks can come from any number of superblocks, in any order
+    // group them so that each superblock is updated once
+    BlockGroups groups(scIdx);
+    char* block = cache->PeekBlock();
+    for (uint32_t idx = 0; idx < blockNum; ++idx) {
+        // adding block overwrites its link
+        char* next = block + *(ptrdiff_t*)block + blockSize;
+        groups.Add(block);
+        block = next;
+    }
+
+    cache->PopList(block, blockNum);
+    groups.Flush();
+
+    // threads that mostly free purge their retained superblocks here
+    sMapCache.Decay();
+}
+
+void BlockGroups::Add(char* block)
+{
+    SizeClassData* sc = &SizeClasses[_scIdx];
+    uint32_t const blockSize = sc->blockSize;
+    // superblocks are aligned to their size, no need to load
+    //  desc->superblock
+    char* superblock = (char*)((size_t)block & ~((size_t)sc->sbSize - 1));
+
+    // consecutive blocks usually share a superblock, so most recent
+    //  groups are checked first
+    BlockGroup* group = nullptr;
+    for (uint32_t idx = _groupNum; idx-- > 0;) {
+        if (_groups[idx].superblock == superblock) {
+            group = &_groups[idx];
+            break;
+        }
+    }
+
+    if (group == nullptr) {
+        if (_groupNum == BLOCK_GROUPS) {
+            Flush();
+        }
+
+        Descriptor* desc = GetPageInfoForPtr(block).GetDesc();
+        ASSERT(desc);
+        ASSERT(superblock == desc->superblock);
+
+        group = &_groups[_groupNum++];
+        group->desc = desc;
+        group->superblock = superblock;
+        group->head = nullptr;
+        group->tail = block;
+        group->count = 0;
+    }
+
+    // link of tail is set when group is flushed
+    if (group->head) {
+        *(ptrdiff_t*)block = group->head - block - blockSize;
+    }
+
+    group->head = block;
+    group->count++;
+}
+
+void BlockGroups::Flush()
+{
+    for (uint32_t idx = 0; idx < _groupNum; ++idx) {
+        BlockGroup& group = _groups[idx];
+        FreeList(_scIdx, group.desc, group.head, group.tail, group.count);
+    }
+
+    _groupNum = 0;
+}
+
+// add a list of blocks of the same superblock to its descriptor
+// if `tail` is nullptr, it's only searched for if the list needs
+//  to be linked to blocks already available in the superblock
+void FreeList(size_t scIdx, Descriptor* desc, char* head, char* tail, uint32_t blockCount)
+{
+    // superblock can't be reused before the CAS below, desc->heap is
+    //  still valid
+    ProcHeap* heap = desc->heap;
+    SizeClassData* sc = &SizeClasses[scIdx];
+    uint32_t const blockSize = sc->blockSize;
+    uint32_t const sbSize = sc->sbSize;
+    // after CAS, desc might become empty and
+    //  concurrently reused, so store maxcount
+    uint32_t const maxcount = sc->GetBlockNum();
+    (void)maxcount; // suppress unused warning
+    char* superblock = (char*)((size_t)head & ~((size_t)sbSize - 1));
+
+    uint32_t idx = ComputeIdx(superblock, head, scIdx);
+
+    Anchor oldAnchor = desc->anchor.load();
+    Anchor newAnchor;
+    do {
+        // update anchor.avail
+        // a full superblock has no available blocks to link to
+        if (oldAnchor.state != SB_FULL) {
+            if (tail == nullptr) {
+                tail = head;
+                for (uint32_t count = 1; count < blockCount; ++count) {
+                    tail += *(ptrdiff_t*)tail + blockSize;
+                }
+            }
+
+            char* next = (char*)(superblock + oldAnchor.avail * blockSize);
+            *(ptrdiff_t*)tail = next - tail - blockSize;
+        }
+
+        newAnchor = oldAnchor;
+        newAnchor.avail = idx;
+        // state updates
+        if (oldAnchor.state == SB_FULL) {
+            newAnchor.state = SB_PARTIAL;
+        }
+
+        ASSERT(oldAnchor.count < desc->maxcount);
+        if (oldAnchor.count + blockCount == desc->maxcount) {
+            newAnchor.count = desc->maxcount - 1;
+            newAnchor.state = SB_EMPTY; // can free superblock
+        } else {
+            newAnchor.count += blockCount;
+        }
+    } while (!desc->anchor.compare_exchange_weak(oldAnchor, newAnchor));
+
+    // after last CAS, can't reliably read any desc fields
+    // as desc might have become empty and been concurrently reused
+    ASSERT(oldAnchor.avail < maxcount || oldAnchor.state == SB_FULL);
+    ASSERT(newAnchor.avail < maxcount);
+    ASSERT(newAnchor.count < maxcount);
+
+    // CAS success, can free block
+    // arenas keep their empty superblocks, in their partial lists
+    if (newAnchor.state == SB_EMPTY && heap->arena) {
+        if (oldAnchor.state == SB_FULL) {
+            HeapPushPartial(desc);
+        }
+    } else if (newAnchor.state == SB_EMPTY) {
+        STATS_ADD(bins[scIdx].sbFrees, 1);
+
+        // unregister descriptor
+        UnregisterDesc(heap, superblock);
+
+        // retain superblock, pages are purged once it decays
+        sMapCache.Free(superblock, sbSize, heap->node);
+
+        // a full superblock isn't in any partial list, so nothing else
+        //  will retire its descriptor
+        if (oldAnchor.state == SB_FULL) {
+            DescRetire(desc);
+        }
+    } else if (oldAnchor.state == SB_FULL) {
+        HeapPushPartial(desc);
+    }
+}
+
+#if LFMALLOC_PERCPU
+// cpu cache is empty, fill it with a batch of blocks and return one
+// returns nullptr if out of memory
+char* PerCpuFill(size_t scIdx)
+{
+    TCacheBin batch(PerCpuBatch(scIdx) + 1);
+    size_t blockNum = 0;
+    MallocFromPartial(scIdx, &batch, blockNum);
+    if (blockNum == 0) {
+        MallocFromNewSB(scIdx, &batch, blockNum);
+        if (UNLIKELY(blockNum == 0)) {
+            return nullptr;
+        }
+    }
+
+    char* ret = batch.PopBlock(scIdx);
+    while (batch.GetBlockNum() > 0) {
+        // block must be popped before it's visible in the cpu cache
+        char* block = batch.PopBlock(scIdx);
+        if (UNLIKELY(!PerCpuPush(scIdx, block))) {
+            // cache was concurrently filled, e.g after migrating cpus
+            batch.PushBlock(block, scIdx);
+            FlushCache(scIdx, &batch, batch.GetBlockNum());
+            break;
+        }
+    }
+
+    // amortized purging of retained superblocks
+    sMapCache.Decay();
+    return ret;
+}
+
+// cpu cache is full, flush a batch of blocks along with `block`
+void PerCpuFlush(size_t scIdx, char* block)
+{
+    TCacheBin batch(PerCpuBatch(scIdx) + 1);
+    batch.PushBlock(block, scIdx);
+    for (uint32_t idx = 0; idx < PerCpuBatch(scIdx); ++idx) {
+        char* ptr = PerCpuPop(scIdx);
+        if (ptr == nullptr) {
+            break;
+        }
+
+        batch.PushBlock(ptr, scIdx);
+    }
+
+    FlushCache(scIdx, &batch, batch.GetBlockNum());
+}
+
+LFMALLOC_INLINE
+char* PerCpuAlloc(size_t scIdx)
+{
+    char* ptr = PerCpuPop(scIdx);
+    if (UNLIKELY(ptr == nullptr)) {
+        ptr = PerCpuFill(scIdx);
+    }
+
+    return ptr;
+}
+#endif
+
+void InitMalloc()
+{
+    LOG_DEBUG();
+
+    // hard assumption that this can't be called concurrently
+    sMallocInit = true;
+
+    // init size classes
+    InitSizeClass();
+
+    // init page map
+    sPageMap.Init(LG_PAGE);
+#if LFMALLOC_SB_PAGEMAP
+    sSbMap.Init(LG_SB_SIZE);
+#endif
+
+    // init numa nodes, before any superblock is mapped
+    InitNuma();
+
+    // init heaps
+    for (uint32_t node = 0; node < NUMA_MAX_NODES; ++node) {
+        for (size_t idx = 0; idx < MAX_SZ_IDX; ++idx) {
+            ProcHeap& heap = sHeaps[node][idx];
+            for (PartialList& list : heap.partialList) {
+                list.head.store({ nullptr });
+            }
+
+            heap.scIdx = idx;
+            heap.node = node;
+            heap.arena = nullptr;
+        }
+    }
+
+    // init heap profiling, if enabled
+    InitProf();
+
+    // init per-cpu caches, if enabled and supported
+    // must be last, may call malloc
+    InitPerCpu();
+}
+
+LFMALLOC_INLINE
+void* do_malloc(size_t size)
+{
+    // ensure malloc is initialized
+    if (UNLIKELY(!sMallocInit)) {
+        InitMalloc();
+    }
+
+#if LFMALLOC_PROF
+    if (UNLIKELY((sProfBytesLeft -= size) < 0) && ProfNextSample()) {
+        return ProfAlloc(size, false);
+    }
+#endif
+
+    // large block allocation
+    if (UNLIKELY(size > MAX_SZ)) {
+        bool zeroed;
+        Descriptor* desc = LargeAlloc(size, zeroed);
+        if (UNLIKELY(desc == nullptr)) {
+            return nullptr;
+        }
+
+        char* ptr = desc->superblock;
+        LOG_DEBUG("large, ptr: %p", ptr);
+        return (void*)ptr;
+    }
+
+    // size class calculation
+    size_t scIdx = GetSizeClass(size);
+    STATS_ADD(bins[scIdx].mallocs, 1);
+
+#if LFMALLOC_PERCPU
+    if (LIKELY(sPerCpu)) {
+        return PerCpuAlloc(scIdx);
+    }
+#endif
+
+    TCacheBin* cache = &TCache[scIdx];
+    // fill cache if needed
+    if (UNLIKELY(cache->GetBlockNum() == 0)) {
+        if (UNLIKELY(!FillCache(scIdx, cache))) {
+            return nullptr;
+        }
+    }
+
+    return cache->PopBlock(scIdx);
+}
+
+// same as do_malloc, but returned memory is zero-filled
+LFMALLOC_INLINE
+void* do_calloc(size_t size)
+{
+    // ensure malloc is initialized
+    if (UNLIKELY(!sMallocInit)) {
+        InitMalloc();
+    }
+
+#if LFMALLOC_PROF
+    if (UNLIKELY((sProfBytesLeft -= size) < 0) && ProfNextSample()) {
+        return ProfAlloc(size, true);
+    }
+#endif
+
+    // memory that comes directly from the OS is already zero-filled
+    //  and doesn't need (nor should be faulted in by) a memset
+    if (UNLIKELY(size > MAX_SZ)) {
+        bool zeroed;
+        Descriptor* desc = LargeAlloc(size, zeroed);
+        if (UNLIKELY(desc == nullptr)) {
+            return nullptr;
+        }
+
+        char* ptr = desc->superblock;
+        if (!zeroed) {
+            memset(ptr, 0x0, size);
+        }
+
+        LOG_DEBUG("large, ptr: %p", ptr);
+        return (void*)ptr;
+    }
+
+    // size class calculation
+    size_t scIdx = GetSizeClass(size);
+    STATS_ADD(bins[scIdx].mallocs, 1);
+
+#if LFMALLOC_PERCPU
+    // cpu caches don't track zero-filled blocks
+    if (LIKELY(sPerCpu)) {
+        void* ptr = PerCpuAlloc(scIdx);
+        if (LIKELY(ptr != nullptr)) {
+            memset(ptr, 0x0, size);
+        }
+
+        return ptr;
+    }
+#endif
+
+    TCacheBin* cache = &TCache[scIdx];
+    // fill cache if needed
+    if (UNLIKELY(cache->GetBlockNum() == 0)) {
+        if (UNLIKELY(!FillCache(scIdx, cache))) {
+            return nullptr;
+        }
+    }
+
+    bool zeroed = cache->IsZeroed();
+    void* ptr = cache->PopBlock(scIdx);
+    if (!zeroed) {
+        memset(ptr, 0x0, size);
+    }
+
+    return ptr;
+}
+
+LFMALLOC_INLINE
+bool isPowerOfTwo(size_t x)
+{
+    // https://stackoverflow.com/questions/3638431/determine-if-an-int-is-a-power-of-2-or-not-in-a-single-line
+    return x && !(x & (x - 1));
+}
+
+// size class of an aligned allocation, `size` must be a multiple of
+//  `alignment`
+// returns 0 if the allocation must be large
+LFMALLOC_INLINE
+size_t GetAlignedSizeClass(size_t alignment, size_t size)
+{
+    // allocations smaller than PAGE will be correctly aligned
+    // this is because size >= alignment, and size will map to a small class
+    // size with the formula 2^X + A*2^(X-1) + C*2^(X-2)
+    // since size is a multiple of alignment, the lowest size class power of
+    // two is already >= alignment
+    // for larger small class sizes, superblocks are aligned to their size,
+    //  so blocks are aligned if the block size is a multiple of alignment
+    // otherwise force such allocations to become large block allocs
+    if (UNLIKELY(size > MAX_SZ)) {
+        return 0;
+    }
+
+    size_t scIdx = GetSizeClass(size);
+    if (SizeClasses[scIdx].blockSize & (alignment - 1)) {
+        return 0;
+    }
+
+    return scIdx;
+}
+
+LFMALLOC_INLINE
+void* do_aligned_alloc(size_t alignment, size_t size)
+{
+    if (UNLIKELY(!isPowerOfTwo(alignment))) {
+        return nullptr;
+    }
+
+    size = ALIGN_VAL(size, alignment);
+
+    ASSERT(size > 0 && alignment > 0 && size >= alignment);
+
+    // @todo: almost equal logic to do_malloc, DRY
+    // ensure malloc is initialized
+    if (UNLIKELY(!sMallocInit)) {
+        InitMalloc();
+    }
 
+    size_t scIdx = GetAlignedSizeClass(alignment, size);
+    if (UNLIKELY(scIdx == 0)) {
+        // hotfix solution for this case is to force allocation to be large
+        // large blocks have no minimum size, so size is kept as is
+        //  instead of wasting MAX_SZ bytes per allocation
+        // large blocks are page-aligned
+        // if user asks for a diabolical alignment, need more pages to
+        // fulfil it
+        bool const needsMorePages = (alignment > PAGE);
+        if (UNLIKELY(needsMorePages)) {
+            size += alignment;
+        }
+
+        bool zeroed;
+        Descriptor* desc = LargeAlloc(size, zeroed);
+        if (UNLIKELY(desc == nullptr)) {
+            return nullptr;
+        }
+
+        char* ptr = desc->superblock;
         if (UNLIKELY(needsMorePages)) {
             ptr = ALIGN_ADDR(ptr, alignment);
             // aligned block must fit into allocated pages
-            ASSERT((ptr + size) <= (desc->superblock + desc->blockSize));
+            // size includes the extra alignment bytes
+            ASSERT((ptr + size - alignment) <= (desc->superblock + desc->blockSize));
 
             // need to update page so that descriptors can be found
             //  for large allocations aligned to "middle" of
             //  superblocks
-            UpdatePageMap(nullptr, ptr, desc, 0L);
+            if (UNLIKELY(!UpdatePageMap(nullptr, ptr, desc, 0L))) {
+                LargeFree(desc);
+                return nullptr;
+            }
         }
 
         LOG_DEBUG("large, ptr: %p", ptr);
         return (void*)ptr;
     }
 
-    ASSERT(size <= PAGE);
+    ASSERT(size <= MAX_SZ);
+    ASSERT((SizeClasses[scIdx].blockSize & (alignment - 1)) == 0);
+    STATS_ADD(bins[scIdx].mallocs, 1);
 
-    // size class calculation
-    size_t scIdx = GetSizeClass(size);
+#if LFMALLOC_PERCPU
+    if (LIKELY(sPerCpu)) {
+        return PerCpuAlloc(scIdx);
+    }
+#endif
 
     TCacheBin* cache = &TCache[scIdx];
     // fill cache if needed
     if (UNLIKELY(cache->GetBlockNum() == 0)) {
-        FillCache(scIdx, cache);
+        if (UNLIKELY(!FillCache(scIdx, cache))) {
+            return nullptr;
+        }
     }
 
     return cache->PopBlock(scIdx);
 }
 
+// free small block of size class `scIdx`
+// `desc` can be nullptr unless remote frees are enabled
+// sampled blocks come from their size class like any other, only the
+//  sample table tells them apart
+LFMALLOC_ATTR(noinline) LFMALLOC_PROF_SECTION
+void* ProfAlloc(size_t size, bool zero)
+{
+    // do_malloc takes `size` off the interval that was just drawn, which
+    //  mustn't trigger another sample
+    sProfBytesLeft += size;
+    void* ptr = zero ? do_calloc(size) : do_malloc(size);
+    if (LIKELY(ptr != nullptr)) {
+        ProfRecord((char*)ptr, size);
+    }
+
+    return ptr;
+}
+
+LFMALLOC_INLINE
+void do_free_small(void* ptr, size_t scIdx, Descriptor* desc)
+{
+    STATS_ADD(bins[scIdx].frees, 1);
+
+#if LFMALLOC_PERCPU
+    if (LIKELY(sPerCpu)) {
+        if (UNLIKELY(!PerCpuPush(scIdx, (char*)ptr))) {
+            PerCpuFlush(scIdx, (char*)ptr);
+        }
+
+        return;
+    }
+#endif
+
+#if LFMALLOC_REMOTE_FREE
+    // blocks of superblocks owned by other threads go back to their
+    //  owner instead of mixing in this thread's cache
+    RemoteInbox* owner = desc->owner;
+    if (owner != sRemoteInbox && owner != nullptr) {
+        RemoteFree(scIdx, owner, (char*)ptr);
+        return;
+    }
+#endif
+
+    TCacheBin* cache = &TCache[scIdx];
+
+    // flush cache if need
+    // bin limit shrinks with repeated flushes
+    if (UNLIKELY(cache->GetBlockNum() >= cache->GetLimit())) {
+        cache->Shrink(scIdx);
+        FlushCache(scIdx, cache, cache->GetFlushNum());
+    }
+
+    cache->PushBlock((char*)ptr, scIdx);
+}
+
 LFMALLOC_INLINE
 void do_free(void* ptr)
 {
@@ -621,46 +1460,77 @@ void do_free(void* ptr)
     size_t scIdx = info.GetScIdx();
 
     LOG_DEBUG("Heap %p, Desc %p, ptr %p", desc->heap, desc, ptr);
+    // arena blocks are only released by lf_arena_destroy
+    ASSERT(!scIdx || desc->heap->arena == nullptr);
+
+#if LFMALLOC_PROF
+    if (UNLIKELY(sProfRate != 0) && ProfMaybeSampled((char*)ptr)) {
+        ProfRemove((char*)ptr);
+    }
+#endif
 
     // large allocation case
     if (UNLIKELY(!scIdx)) {
-        char* superblock = desc->superblock;
-
-        // unregister descriptor
-        UnregisterDesc(nullptr, superblock);
         // aligned large allocation case
-        if (UNLIKELY((char*)ptr != superblock)) {
+        if (UNLIKELY((char*)ptr != desc->superblock)) {
             UnregisterDesc(nullptr, (char*)ptr);
         }
 
-        // free superblock
-        PageFree(superblock, desc->blockSize);
+        LargeFree(desc);
+        return;
+    }
 
-        // desc cannot be in any partial list, so it can be
-        //  immediately reused
-        DescRetire(desc);
+    do_free_small(ptr, scIdx, desc);
+}
+
+// same as do_free, but the size class comes from the size the block was
+//  requested with, which saves the pagemap lookup for small blocks
+// `alignment` is 0 for unaligned allocations
+LFMALLOC_INLINE
+void do_free_sized(void* ptr, size_t alignment, size_t size)
+{
+#if LFMALLOC_REMOTE_FREE
+    // remote frees need the superblock owner, from the descriptor the
+    //  pagemap lookup finds
+    (void)alignment;
+    (void)size;
+    do_free(ptr);
+#else
+    // sampled blocks must leave the sample table
+#if LFMALLOC_PROF
+    if (UNLIKELY(sProfRate != 0)) {
+        do_free(ptr);
         return;
     }
+#endif
 
-    TCacheBin* cache = &TCache[scIdx];
-    SizeClassData* sc = &SizeClasses[scIdx];
+    size_t scIdx;
+    if (alignment == 0) {
+        scIdx = size <= MAX_SZ ? GetSizeClass(size) : 0;
+    } else {
+        scIdx = GetAlignedSizeClass(alignment, ALIGN_VAL(size, alignment));
+    }
 
-    // flush cache if need
-    if (UNLIKELY(cache->GetBlockNum() >= sc->cacheBlockNum)) {
-        FlushCache(scIdx, cache);
+    // large blocks are freed through their descriptor
+    if (UNLIKELY(scIdx == 0)) {
+        do_free(ptr);
+        return;
     }
 
-    cache->PushBlock((char*)ptr, scIdx);
+    // size must be the one the block was allocated with
+    ASSERT(GetPageInfoForPtr(ptr).GetScIdx() == scIdx);
+    do_free_small(ptr, scIdx, nullptr);
+#endif
 }
 
-extern "C" void* lf_malloc(size_t size) noexcept
+extern "C" LFMALLOC_PROF_SECTION void* lf_malloc(size_t size) noexcept
 {
     LOG_DEBUG("size: %lu", size);
 
     return do_malloc(size);
 }
 
-extern "C" void* lf_calloc(size_t n, size_t size) noexcept
+extern "C" LFMALLOC_PROF_SECTION void* lf_calloc(size_t n, size_t size) noexcept
 {
     LOG_DEBUG();
     size_t allocSize = n * size;
@@ -670,19 +1540,11 @@ extern "C" void* lf_calloc(size_t n, size_t size) noexcept
         return nullptr;
     }
 
-    void* ptr = do_malloc(allocSize);
-
     // calloc returns zero-filled memory
-    // @todo: optimize, memory may be already zero-filled
-    //  if coming directly from OS
-    if (LIKELY(ptr != nullptr)) {
-        memset(ptr, 0x0, allocSize);
-    }
-
-    return ptr;
+    return do_calloc(allocSize);
 }
 
-extern "C" void* lf_realloc(void* ptr, size_t size) noexcept
+extern "C" LFMALLOC_PROF_SECTION void* lf_realloc(void* ptr, size_t size) noexcept
 {
     LOG_DEBUG();
 
@@ -700,14 +1562,41 @@ extern "C" void* lf_realloc(void* ptr, size_t size) noexcept
             return nullptr;
         }
 
+        if (UNLIKELY(!info.GetScIdx())) {
+            // large blocks are grown/shrunk without copying
+            // unless shrunk to a small size, see below
+            if (LIKELY((char*)ptr == desc->superblock) && size > MAX_SZ) {
+                void* newPtr = LargeRealloc(desc, size);
+#if LFMALLOC_PROF
+                if (UNLIKELY(sProfRate != 0) && newPtr != nullptr && ProfMaybeSampled((char*)ptr)) {
+                    ProfMove((char*)ptr, (char*)newPtr, size);
+                }
+#endif
+                return newPtr;
+            }
+
+            // aligned large allocation, block starts past superblock
+            blockSize -= (char*)ptr - desc->superblock;
+        }
+
         // nothing to do, block is already large enough
-        if (UNLIKELY(size <= blockSize))
+        // blocks must stay in the size class of `size`, so that
+        //  free_sized can derive it, shrinking below it moves the block
+        //  (to a small block, if it was large)
+        size_t scIdx = info.GetScIdx();
+        if (UNLIKELY(size <= blockSize) && (scIdx ? GetSizeClass(size) == scIdx : size > MAX_SZ)) {
+#if LFMALLOC_PROF
+            if (UNLIKELY(sProfRate != 0) && ProfMaybeSampled((char*)ptr)) {
+                ProfMove((char*)ptr, (char*)ptr, size);
+            }
+#endif
             return ptr;
+        }
     }
 
     void* newPtr = do_malloc(size);
     if (LIKELY(ptr && newPtr)) {
-        memcpy(newPtr, ptr, blockSize);
+        memcpy(newPtr, ptr, std::min(blockSize, size));
         do_free(ptr);
     }
 
@@ -727,13 +1616,20 @@ extern "C" size_t lf_malloc_usable_size(void* ptr) noexcept
     if (UNLIKELY(!scIdx)) {
         Descriptor* desc = info.GetDesc();
         ASSERT(desc);
-        return desc->blockSize;
+        return desc->blockSize - ((char*)ptr - desc->superblock);
     }
 
     SizeClassData* sc = &SizeClasses[scIdx];
     return sc->blockSize;
 }
 
+extern "C" void lf_malloc_desc_stats(size_t* active, size_t* resident) noexcept
+{
+    LOG_DEBUG();
+    *active = sDescActive.load(std::memory_order_relaxed) * sizeof(Descriptor);
+    *resident = sDescResident.load(std::memory_order_relaxed);
+}
+
 extern "C" int lf_posix_memalign(void** memptr, size_t alignment, size_t size) noexcept
 {
     LOG_DEBUG();
@@ -787,3 +1683,363 @@ extern "C" void lf_free(void* ptr) noexcept
 
     do_free(ptr);
 }
+
+extern "C" void lf_free_sized(void* ptr, size_t size) noexcept
+{
+    LOG_DEBUG("ptr: %p, size: %lu", ptr, size);
+    if (UNLIKELY(!ptr)) {
+        return;
+    }
+
+    do_free_sized(ptr, 0, size);
+}
+
+extern "C" void lf_free_aligned_sized(void* ptr, size_t alignment, size_t size) noexcept
+{
+    LOG_DEBUG("ptr: %p, alignment: %lu, size: %lu", ptr, alignment, size);
+    if (UNLIKELY(!ptr)) {
+        return;
+    }
+
+    do_free_sized(ptr, alignment, size);
+}
+
+extern "C" LFMALLOC_PROF_SECTION size_t lf_malloc_batch(size_t size, size_t n, void** ptrs) noexcept
+{
+    LOG_DEBUG("size: %lu, n: %lu", size, n);
+
+    // ensure malloc is initialized
+    if (UNLIKELY(!sMallocInit)) {
+        InitMalloc();
+    }
+
+    // large blocks, sampling and cpu caches go one by one
+    bool single = size > MAX_SZ;
+#if LFMALLOC_PROF
+    single |= sProfRate != 0;
+#endif
+#if LFMALLOC_PERCPU
+    single |= sPerCpu;
+#endif
+    if (UNLIKELY(single)) {
+        for (size_t idx = 0; idx < n; ++idx) {
+            ptrs[idx] = do_malloc(size);
+            if (UNLIKELY(ptrs[idx] == nullptr)) {
+                return idx;
+            }
+        }
+
+        return n;
+    }
+
+    size_t scIdx = GetSizeClass(size);
+    SizeClassData* sc = &SizeClasses[scIdx];
+    uint32_t const blockSize = sc->blockSize;
+
+    TCacheBin* cache = &TCache[scIdx];
+    size_t idx = 0;
+    while (idx < n) {
+        TCacheBin* bin = cache;
+        TCacheBin batch(std::min<size_t>(n - idx, sc->GetBlockNum()));
+        if (cache->GetBlockNum() == 0) {
+            // more than a cache worth of blocks is carved straight from a
+            //  superblock, without going through the cache
+            if (n - idx > cache->GetLimit()) {
+                size_t blockNum = 0;
+                MallocFromPartial(scIdx, &batch, blockNum);
+                if (blockNum == 0) {
+                    MallocFromNewSB(scIdx, &batch, blockNum);
+                    if (UNLIKELY(blockNum == 0)) {
+                        STATS_ADD(bins[scIdx].mallocs, idx);
+                        return idx;
+                    }
+                }
+
+                // amortized purging of retained superblocks
+                sMapCache.Decay();
+                bin = &batch;
+            } else if (UNLIKELY(!FillCache(scIdx, cache))) {
+                STATS_ADD(bins[scIdx].mallocs, idx);
+                return idx;
+            }
+        }
+
+        // take a whole run of blocks off the bin
+        uint32_t take = std::min<size_t>(bin->GetBlockNum(), n - idx);
+        char* block = bin->PeekBlock();
+        for (uint32_t count = 0; count < take; ++count) {
+            ptrs[idx++] = block;
+            block += *(ptrdiff_t*)block + blockSize;
+        }
+
+        bin->PopList(block, take);
+        ASSERT(bin == cache || bin->GetBlockNum() == 0);
+    }
+
+    STATS_ADD(bins[scIdx].mallocs, n);
+    return n;
+}
+
+extern "C" void lf_free_batch(void** ptrs, size_t n) noexcept
+{
+    LOG_DEBUG("n: %lu", n);
+
+#if LFMALLOC_PROF
+    // sampled blocks must leave the sample table, see do_free
+    if (UNLIKELY(sProfRate != 0)) {
+        for (size_t idx = 0; idx < n; ++idx) {
+            if (ptrs[idx] != nullptr) {
+                do_free(ptrs[idx]);
+            }
+        }
+
+        return;
+    }
+#endif
+
+    bool useCache = true;
+#if LFMALLOC_PERCPU
+    useCache = !sPerCpu;
+#endif
+
+    size_t idx = 0;
+    while (idx < n) {
+        void* ptr = ptrs[idx];
+        if (UNLIKELY(ptr == nullptr)) {
+            ++idx;
+            continue;
+        }
+
+        PageInfo info = GetPageInfoForPtr(ptr);
+        size_t scIdx = info.GetScIdx();
+        if (UNLIKELY(scIdx == 0)) {
+            do_free(ptr);
+            ++idx;
+            continue;
+        }
+
+        // run of blocks of the same size class, the thread cache takes
+        //  what it has room for and the rest goes back to superblocks
+        //  with one CAS each
+        // blocks in the superblock of the previous one skip the pagemap
+        SizeClassData* sc = &SizeClasses[scIdx];
+        TCacheBin* cache = &TCache[scIdx];
+        BlockGroups groups(scIdx);
+        // bin limit shrinks once per run that overflows it, as it
+        //  would with one flush per block that doesn't fit
+        bool shrunk = false;
+        Descriptor* desc = info.GetDesc();
+        while (true) {
+            STATS_ADD(bins[scIdx].frees, 1);
+            bool remote = false;
+#if LFMALLOC_REMOTE_FREE
+            // blocks of superblocks owned by other threads go back to
+            //  their owner, see do_free_small
+            remote = useCache && desc->owner != sRemoteInbox && desc->owner != nullptr;
+#endif
+            if (UNLIKELY(remote)) {
+                RemoteFree(scIdx, desc->owner, (char*)ptr);
+            } else if (useCache && cache->GetBlockNum() < cache->GetLimit()) {
+                cache->PushBlock((char*)ptr, scIdx);
+            } else {
+                if (useCache && !shrunk) {
+                    cache->Shrink(scIdx);
+                    shrunk = true;
+                }
+
+                groups.Add((char*)ptr);
+            }
+
+            if (++idx == n) {
+                break;
+            }
+
+            ptr = ptrs[idx];
+            if (ptr == nullptr) {
+                break;
+            }
+
+            if ((size_t)((char*)ptr - desc->superblock) >= sc->sbSize) {
+                info = GetPageInfoForPtr(ptr);
+                if (info.GetScIdx() != scIdx) {
+                    break;
+                }
+
+                desc = info.GetDesc();
+            }
+        }
+
+        groups.Flush();
+    }
+}
+
+void ArenaCacheFlush(ArenaCache* cache)
+{
+    Arena* arena = cache->arena;
+    if (arena) {
+        // lf_arena_destroy bumps the generation before waiting for
+        //  flushers, either it waits for this flush or the flush sees
+        //  the arena is gone and its blocks with it
+        arena->flushers.fetch_add(1);
+        if (arena->generation.load() == cache->generation) {
+            for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
+                TCacheBin* bin = &cache->bins[scIdx];
+                if (bin->GetBlockNum() > 0) {
+                    FlushCache(scIdx, bin, bin->GetBlockNum());
+                }
+            }
+        }
+
+        arena->flushers.fetch_sub(1);
+    }
+
+    for (TCacheBin& bin : cache->bins) {
+        bin = TCacheBin();
+    }
+
+    cache->arena = nullptr;
+}
+
+// arena cache bin is empty, fill it from the arena's superblocks
+// returns false if out of memory
+static bool ArenaFillCache(Arena* arena, size_t scIdx, TCacheBin* bin)
+{
+#if LFMALLOC_STATS
+    InitThreadStats();
+#endif
+    STATS_ADD(bins[scIdx].fills, 1);
+
+    if (bin->GetLimit() == 0) {
+        *bin = TCacheBin(ArenaCacheLimit(scIdx));
+    }
+
+    size_t blockNum = 0;
+    ProcHeap* heap = &arena->heaps[scIdx];
+    MallocFromPartial(scIdx, bin, blockNum, heap);
+    if (blockNum == 0) {
+        MallocFromNewSB(scIdx, bin, blockNum, heap);
+        if (UNLIKELY(blockNum == 0)) {
+            return false;
+        }
+    }
+
+    // amortized purging of retained superblocks
+    sMapCache.Decay();
+    return true;
+}
+
+extern "C" lf_arena_t* lf_arena_create() noexcept
+{
+    LOG_DEBUG();
+
+    // ensure malloc is initialized
+    if (UNLIKELY(!sMallocInit)) {
+        InitMalloc();
+    }
+
+    return (lf_arena_t*)ArenaAlloc(GetNumaNode());
+}
+
+extern "C" LFMALLOC_PROF_SECTION void* lf_arena_malloc(lf_arena_t* arenaPtr, size_t size) noexcept
+{
+    LOG_DEBUG("arena: %p, size: %lu", arenaPtr, size);
+
+    Arena* arena = (Arena*)arenaPtr;
+    if (arena == nullptr) {
+        arena = sThreadArena;
+        if (arena == nullptr) {
+            return do_malloc(size);
+        }
+    }
+
+    if (UNLIKELY(size > MAX_SZ)) {
+        bool zeroed;
+        Descriptor* desc = LargeAlloc(size, zeroed);
+        if (UNLIKELY(desc == nullptr)) {
+            return nullptr;
+        }
+
+        arena->Track(arena->largeBlocks, desc);
+        return desc->superblock;
+    }
+
+    // not counted in bin mallocs, as blocks are never freed one by one
+    size_t scIdx = GetSizeClass(size);
+
+    // cache holds blocks of one arena at a time
+    ArenaCache* cache = &sArenaCache;
+    uint64_t generation = arena->generation.load(std::memory_order_relaxed);
+    if (UNLIKELY(cache->arena != arena || cache->generation != generation)) {
+        ArenaCacheFlush(cache);
+        cache->arena = arena;
+        cache->generation = generation;
+    }
+
+    TCacheBin* bin = &cache->bins[scIdx];
+    if (UNLIKELY(bin->GetBlockNum() == 0)) {
+        if (UNLIKELY(!ArenaFillCache(arena, scIdx, bin))) {
+            return nullptr;
+        }
+    }
+
+    return bin->PopBlock(scIdx);
+}
+
+extern "C" void lf_arena_destroy(lf_arena_t* arenaPtr) noexcept
+{
+    LOG_DEBUG("arena: %p", arenaPtr);
+
+    Arena* arena = (Arena*)arenaPtr;
+    if (UNLIKELY(arena == nullptr)) {
+        return;
+    }
+
+    if (sThreadArena == arena) {
+        sThreadArena = nullptr;
+    }
+
+    // blocks cached by other threads are dropped on their next use of
+    //  their cache, wait for those already being flushed
+    arena->generation.fetch_add(1);
+    Backoff backoff;
+    while (arena->flushers.load() != 0) {
+        backoff.Pause();
+    }
+
+    // this thread's cached blocks go away with their superblocks
+    if (sArenaCache.arena == arena) {
+        ArenaCacheFlush(&sArenaCache);
+    }
+
+    // whole superblocks are returned, blocks still in use or not
+    Descriptor* desc = arena->superblocks.exchange(nullptr);
+    while (desc) {
+        Descriptor* next = desc->nextArena;
+        ProcHeap* heap = desc->heap;
+        SizeClassData* sc = heap->GetSizeClass();
+        STATS_ADD(bins[heap->scIdx].sbFrees, 1);
+
+        UnregisterDesc(heap, desc->superblock);
+        sMapCache.Free(desc->superblock, sc->sbSize, heap->node);
+        DescRetire(desc);
+        desc = next;
+    }
+
+    desc = arena->largeBlocks.exchange(nullptr);
+    while (desc) {
+        Descriptor* next = desc->nextArena;
+        LargeFree(desc);
+        desc = next;
+    }
+
+    ArenaRecycle(arena);
+}
+
+extern "C" lf_arena_t* lf_arena_bind(lf_arena_t* arena) noexcept
+{
+    LOG_DEBUG("arena: %p", arena);
+
+    Arena* old = sThreadArena;
+    sThreadArena = (Arena*)arena;
+    return (lf_arena_t*)old;
+}
@@ -74,6 +74,8 @@
 
 #define lf_malloc malloc
 #define lf_free free
+#define lf_free_sized free_sized
+#define lf_free_aligned_sized free_aligned_sized
 #define lf_calloc calloc
 #define lf_realloc realloc
 #define lf_malloc_usable_size malloc_usable_size
@@ -95,8 +97,83 @@ void* lf_calloc(size_t n, size_t size) LFMALLOC_EXPORT LFMALLOC_NOTHROW
     LFMALLOC_ALLOC_SIZE2(1, 2) LFMALLOC_CACHE_ALIGNED_FN;
 void* lf_realloc(void* ptr, size_t size) LFMALLOC_EXPORT LFMALLOC_NOTHROW
     LFMALLOC_ALLOC_SIZE(2) LFMALLOC_CACHE_ALIGNED_FN;
+// C23 sized frees, `size` (and `alignment`) must be the ones the block was
+//  allocated with, or the size of the last realloc
+// small blocks are freed without the pagemap lookup, except with
+//  LFMALLOC_REMOTE_FREE or sampling enabled, where it's the same as free
+void lf_free_sized(void* ptr, size_t size) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
+// for blocks from aligned_alloc
+void lf_free_aligned_sized(void* ptr, size_t alignment, size_t size) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
+// allocate `n` blocks of `size` bytes into `ptrs`
+// small blocks are taken off the thread cache or a superblock in runs
+// returns the number of blocks allocated, less than `n` only if out
+//  of memory
+size_t lf_malloc_batch(size_t size, size_t n, void** ptrs) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
+// free `n` blocks, nullptr entries are skipped
+// consecutive blocks of a size class that don't fit in the thread cache
+//  go back to their superblocks with one CAS per superblock
+void lf_free_batch(void** ptrs, size_t n) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
+// arenas, for allocations that are all released at once
+// arena blocks must not be passed to free or realloc, they're released
+//  when their arena is destroyed
+// neither to free_sized, free_aligned_sized, sized delete or
+//  lf_free_batch, which skip the arena check LFMALLOC_SANITY adds to free
+// small arena blocks aren't counted by the stats.small and stats.bins
+//  counters of lf_mallctl, their superblocks are
+// an arena can be used by several threads at once, but not while or
+//  after it's destroyed
+typedef struct lf_arena lf_arena_t;
+// returns nullptr if out of memory
+lf_arena_t* lf_arena_create(void) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
+// allocate from `arena`, or from the thread's bound arena if nullptr
+// with neither, same as malloc
+void* lf_arena_malloc(lf_arena_t* arena, size_t size) LFMALLOC_EXPORT LFMALLOC_NOTHROW
+    LFMALLOC_ALLOC_SIZE(2);
+// release all blocks of `arena`, whole superblocks at a time
+void lf_arena_destroy(lf_arena_t* arena) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
+// bind `arena` as the calling thread's default, nullptr unbinds
+// returns the previously bound arena
+lf_arena_t* lf_arena_bind(lf_arena_t* arena) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
 // utilities
 size_t lf_malloc_usable_size(void* ptr);
+// descriptor memory, in bytes
+// `active` is held by descriptors in use, `resident` by descriptor blocks
+//  that weren't purged
+void lf_malloc_desc_stats(size_t* active, size_t* resident) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
+// read allocator state by name, in the style of jemalloc's mallctl
+// values are uint64_t, `*oldlenp` must be sizeof(uint64_t)
+// state is read-only, `newp` must be nullptr
+// returns 0 on success, ENOENT for unknown names, EINVAL for a bad
+//  `oldlenp` and EPERM if `newp` is set
+// names:
+//  bins.count                   number of size classes, 0 is for large
+//  bins.<i>.size                block size of size class i
+//  thread.tcache.cached         bytes cached by the calling thread
+//  stats.enabled                1 if built with LFMALLOC_STATS
+//  stats.descriptors.active     bytes of descriptors in use
+//  stats.descriptors.resident   bytes of descriptor blocks not purged
+// with LFMALLOC_STATS, aggregated over all threads:
+//  stats.small.allocated        bytes of small blocks handed out
+//  stats.large.allocated        bytes of large blocks handed out
+//  stats.large.nmalloc          large allocations
+//  stats.large.nfree            large frees
+//  stats.superblocks.mapped     superblock bytes mapped from the OS
+//  stats.superblocks.unmapped   superblock bytes unmapped
+//  stats.superblocks.purged     superblock bytes purged
+//  stats.bins.<i>.nmalloc       allocations of size class i
+//  stats.bins.<i>.nfree         frees of size class i
+//  stats.bins.<i>.nfills        thread cache fills of size class i
+//  stats.bins.<i>.nflushes      thread cache flushes of size class i
+//  stats.bins.<i>.partial       superblocks in partial lists
+//  stats.bins.<i>.superblocks   superblocks in use
+int lf_mallctl(const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen)
+    LFMALLOC_EXPORT LFMALLOC_NOTHROW;
+// write live sampled allocations to `fd` as a pprof heap profile
+// needs LFMALLOC_PROF and sampling enabled through LFMALLOC_PROF_RATE
+// if LFMALLOC_PROF_SIGNAL is set, that signal dumps a profile to
+//  lrmalloc.<pid>.<n>.heap in the working directory
+// returns 0 on success or ENOENT if sampling is disabled
+int lf_prof_dump(int fd) LFMALLOC_EXPORT LFMALLOC_NOTHROW;
 // memory alignment ops
 int lf_posix_memalign(void** memptr, size_t alignment, size_t size) LFMALLOC_EXPORT LFMALLOC_NOTHROW
     LFMALLOC_ATTR(nonnull(1));
@@ -24,9 +24,11 @@ enum SuperblockState : uint8_t {
 };
 
 struct Anchor;
+struct Arena;
 struct DescriptorNode;
 struct Descriptor;
 struct ProcHeap;
+struct RemoteInbox;
 struct SizeClassData;
 struct TCacheBin;
 
@@ -74,7 +76,8 @@ STATIC_ASSERT(sizeof(DescriptorNode) == sizeof(uint64_t), "Invalid descriptor no
 
 // Superblock descriptor
 // needs to be cache-line aligned
-// descriptors are allocated and *never* freed
+// descriptors are never unmapped, as lock-free list ops can read stale
+//  descriptors, but pages of chunks with only free descriptors are purged
 struct Descriptor {
     // list node pointers
     // used in free descriptor list
@@ -86,17 +89,48 @@ struct Descriptor {
 
     char* superblock;
     ProcHeap* heap;
+    // inbox of thread that last took blocks from the superblock
+    // only used with LFMALLOC_REMOTE_FREE, see remote.h
+    RemoteInbox* owner;
     uint32_t blockSize; // block size
     uint32_t maxcount;
+    // next superblock or large block of the same arena, see arena.h
+    Descriptor* nextArena;
+} LFMALLOC_CACHE_ALIGNED;
+
+STATIC_ASSERT(sizeof(Descriptor) == CACHELINE, "Descriptor must fit in a cache line");
+
+// number of partial lists per heap
+// threads push to and pop from their own shard first, so that the
+//  list heads of hot size classes aren't all contended
+#ifndef LFMALLOC_PARTIAL_SHARDS
+#define LFMALLOC_PARTIAL_SHARDS 4
+#endif
+// max number of pause instructions between retries of a failed CAS
+#define BACKOFF_MAX_SPINS 64
+
+// head of a partial descriptor list, one per cache line
+struct PartialList {
+    std::atomic<DescriptorNode> head;
 } LFMALLOC_CACHE_ALIGNED;
 
 // at least one ProcHeap instance exists for each sizeclass
+// with numa enabled, there's one instance per node and sizeclass
 struct ProcHeap {
 public:
-    // ptr to descriptor, head of partial descriptor list
-    std::atomic<DescriptorNode> partialList;
+    // ptr to descriptor, heads of partial descriptor lists
+    PartialList partialList[LFMALLOC_PARTIAL_SHARDS];
     // size class index
     size_t scIdx;
+    // numa node superblocks of this heap are bound to, and retained
+    //  for once empty
+    // nodes past NUMA_MAX_NODES share heaps with lower nodes, but bind
+    //  their superblocks to their own node
+    uint32_t node;
+    // arena that owns the heap, nullptr for the process heaps
+    // empty superblocks of arena heaps are kept until the arena is
+    //  destroyed
+    Arena* arena;
 
 public:
     size_t GetScIdx() const { return scIdx; }
@@ -104,9 +138,111 @@ public:
 
 } LFMALLOC_ATTR(aligned(CACHELINE));
 
+// exponential backoff between retries of a failed CAS on a shared
+//  list head, so that contending threads spread out
+struct Backoff {
+public:
+    void Pause()
+    {
+        for (uint32_t idx = 0; idx < _spins; ++idx) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#else
+            __asm__ __volatile__("" ::: "memory");
+#endif
+        }
+
+        if (_spins < BACKOFF_MAX_SPINS) {
+            _spins *= 2;
+        }
+    }
+
+private:
+    uint32_t _spins = 1;
+};
+
+// max number of superblocks grouped at once by BlockGroups
+#define BLOCK_GROUPS 16
+
+// list of blocks being freed that belong to the same superblock
+// blocks are linked like cache bin blocks
+struct BlockGroup {
+    Descriptor* desc;
+    char* superblock;
+    char* head;
+    char* tail;
+    uint32_t count;
+};
+
+// groups blocks of a size class being freed by superblock, so that each
+//  superblock gets its blocks back with a single CAS, however interleaved
+//  the blocks were
+struct BlockGroups {
+public:
+    explicit BlockGroups(size_t scIdx)
+        : _scIdx(scIdx)
+    {
+    }
+
+    // add block to the group of its superblock
+    // if there's no room for a new group, all groups are flushed first
+    void Add(char* block);
+    // return all grouped blocks to their superblocks
+    void Flush();
+
+private:
+    size_t _scIdx;
+    uint32_t _groupNum = 0;
+    BlockGroup _groups[BLOCK_GROUPS];
+};
+
 // size of allocated block when allocating descriptors
 // block is split into multiple descriptors
-// 64k byte blocks
+// 64k byte blocks, aligned to their size
 #define DESCRIPTOR_BLOCK_SZ (16 * PAGE)
+// a reclaim pass runs at most once every this many retired descriptors
+//  (or as many as were left available by the last pass, if more)
+//  or when the last active descriptor of a chunk is retired
+//  and only if most descriptors are available
+#define DESC_RECLAIM_RETIRES 1024
+
+// descriptors of each kind come from separate blocks, so that a few
+//  long-lived superblock descriptors don't keep blocks of short-lived
+//  large allocation descriptors from being purged
+enum DescKind : uint32_t {
+    // superblocks of a size class
+    DESC_SUPERBLOCK = 0,
+    // large allocations and pooled superblocks
+    DESC_LARGE = 1,
+    DESC_KINDS = 2,
+};
+
+// header of a block of descriptors, in its first cache line
+// the page holding the header is never purged
+struct DescChunk {
+    // next chunk in purged chunk list, aba counter in low bits
+    std::atomic<uint64_t> next;
+    // kind of descriptors in the chunk
+    DescKind kind;
+    // number of descriptors of the chunk found available by the current
+    //  reclaim pass
+    uint32_t reclaimNum;
+    // descriptors of the chunk handed out by DescAlloc and not yet retired
+    std::atomic<uint32_t> active;
+} LFMALLOC_CACHE_ALIGNED;
+
+// number of descriptors in a block
+#define DESC_CHUNK_NUM ((DESCRIPTOR_BLOCK_SZ - sizeof(DescChunk)) / sizeof(Descriptor))
+
+// descriptor management
+// returns nullptr if out of memory
+Descriptor* DescAlloc(DescKind kind);
+void DescRetire(Descriptor* desc);
+// purge descriptor blocks whose descriptors are all available
+void DescReclaim();
+// (un)register descriptor pages with pagemap
+// returns false if out of memory, in which case nothing is registered
+bool RegisterDesc(Descriptor* desc);
+void UnregisterDesc(ProcHeap* heap, char* superblock);
 
 #endif // __LFMALLOC_INTERNAL_H
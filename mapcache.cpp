@@ -6,6 +6,342 @@
 
 #include "mapcache.h"
 
+#include "stats.h"
+
+#include <time.h>
+
 // thread cache, uses tsd/tls
 // one cache per thread
 __thread MapCacheBin sMapCache;
+// shared by all threads
+SuperblockPool sSbPool[NUMA_MAX_NODES];
+// rings of all threads, including exited ones
+static std::atomic<RetainedRing*> sRetainedRings({ nullptr });
+// time (ms) of last purge pass over all rings
+static std::atomic<uint64_t> sLastDecayAll({ 0 });
+
+// coarse monotonic clock, cheap enough for slow paths
+static uint64_t GetTimeMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+char* MapCacheBin::Alloc(size_t size, uint32_t node, bool& zeroed)
+{
+    // most recently retained superblocks are the most likely to
+    //  still be in cpu caches and backed by pages
+    RetainedRing* ring = _ring;
+    if (ring != nullptr) {
+        ring->Lock();
+        for (uint32_t idx = ring->num; idx-- > 0;) {
+            RetainedSB& retained = ring->Get(idx);
+            if (retained.size != size || retained.node != node) {
+                continue;
+            }
+
+            char* ret = retained.block;
+            zeroed = retained.zeroed;
+            // keep ring buffer contiguous
+            for (uint32_t next = idx + 1; next < ring->num; ++next) {
+                ring->Get(next - 1) = ring->Get(next);
+            }
+
+            ring->num--;
+            ring->Unlock();
+            return ret;
+        }
+
+        ring->Unlock();
+    }
+
+    char* pooled = sSbPool[GetNumaIdx(node)].Alloc(size, zeroed);
+    if (pooled) {
+        return pooled;
+    }
+
+    zeroed = true;
+    if (size != SB_SIZE) {
+        char* ret = (char*)PageAllocHuge(size, size);
+        if (ret != nullptr) {
+            STATS_ADD(sbMapBytes, size);
+            NumaBind(ret, size, node);
+        }
+
+        return ret;
+    }
+
+    // thread moved to another node, rest of the batch goes to the pool
+    //  of the node it's bound to
+    if (_blockNum > 0 && _blockNode != node) {
+        FlushBatch();
+    }
+
+    if (_blockNum == 0) {
+        _block = (char*)PageAllocHuge(SB_SIZE * MAPCACHE_SIZE, SB_SIZE);
+        if (_block == nullptr) {
+            return nullptr;
+        }
+        _blockNum = MAPCACHE_SIZE;
+        _blockNode = node;
+        STATS_ADD(sbMapBytes, SB_SIZE * MAPCACHE_SIZE);
+        // pages aren't faulted in yet, so all of them follow the policy
+        NumaBind(_block, SB_SIZE * MAPCACHE_SIZE, node);
+    }
+    char* ret = _block;
+    _block += SB_SIZE;
+    _blockNum--;
+    return ret;
+}
+
+void MapCacheBin::Free(char* block, size_t size, uint32_t node)
+{
+    if (UNLIKELY(_ring == nullptr) && !_finalized) {
+        _ring = AcquireRing();
+    }
+
+    // thread is exiting, or no ring could be mapped
+    RetainedRing* ring = _ring;
+    if (UNLIKELY(ring == nullptr)) {
+        STATS_ADD(sbPurgeBytes, size);
+        bool zeroed = PagePurge(block, size);
+        sSbPool[GetNumaIdx(node)].Free(block, size, zeroed);
+        return;
+    }
+
+    uint64_t now = GetTimeMs();
+    ring->Lock();
+    if (ring->num == MAPCACHE_RETAIN) {
+        // share oldest superblock with other threads
+        RetainedSB& oldest = ring->Get(0);
+        if (!oldest.purged) {
+            STATS_ADD(sbPurgeBytes, oldest.size);
+            oldest.zeroed = PagePurge(oldest.block, oldest.size);
+        }
+
+        sSbPool[GetNumaIdx(oldest.node)].Free(oldest.block, oldest.size, oldest.zeroed);
+        ring->head = (ring->head + 1) % MAPCACHE_RETAIN;
+        ring->num--;
+    }
+
+    RetainedSB& retained = ring->Get(ring->num++);
+    retained.block = block;
+    retained.size = size;
+    retained.node = node;
+    retained.time = now;
+    retained.purged = false;
+    retained.zeroed = false;
+    ring->Unlock();
+
+    Decay();
+}
+
+void MapCacheBin::Decay()
+{
+    // check at most every 1/10th of the decay time, so that
+    //  superblocks are purged at most 10% later than due
+    uint64_t now = GetTimeMs();
+    if (now - _lastPurge < LFMALLOC_DECAY_MS / 10) {
+        return;
+    }
+
+    _lastPurge = now;
+    RetainedRing* ring = _ring;
+    if (ring != nullptr && ring->num > 0) {
+        ring->Lock();
+        ring->PurgeDue(now);
+        ring->Unlock();
+    }
+
+    // threads that stopped allocating never get here themselves
+    DecayAll(now);
+}
+
+void MapCacheBin::DecayAll(uint64_t now)
+{
+    uint64_t last = sLastDecayAll.load(std::memory_order_relaxed);
+    if (now - last < LFMALLOC_DECAY_MS / 10
+        || !sLastDecayAll.compare_exchange_strong(last, now)) {
+        return;
+    }
+
+    for (RetainedRing* ring = sRetainedRings.load(); ring; ring = ring->next) {
+        // skipped rather than waited for, another pass comes soon enough
+        if (!ring->busy.exchange(true, std::memory_order_acquire)) {
+            ring->PurgeDue(now);
+            ring->Unlock();
+        }
+    }
+}
+
+void MapCacheBin::Flush()
+{
+    FlushBatch();
+
+    _finalized = true;
+    RetainedRing* ring = _ring;
+    if (ring == nullptr) {
+        return;
+    }
+
+    ring->Lock();
+    for (uint32_t idx = 0; idx < ring->num; ++idx) {
+        RetainedSB& retained = ring->Get(idx);
+        if (!retained.purged) {
+            STATS_ADD(sbPurgeBytes, retained.size);
+            retained.zeroed = PagePurge(retained.block, retained.size);
+        }
+
+        sSbPool[GetNumaIdx(retained.node)].Free(retained.block, retained.size, retained.zeroed);
+    }
+
+    ring->num = 0;
+    ring->Unlock();
+
+    // ring may be reused by a new thread
+    _ring = nullptr;
+    ring->used.store(false);
+}
+
+RetainedRing* MapCacheBin::AcquireRing()
+{
+    // reuse ring of an exited thread
+    for (RetainedRing* ring = sRetainedRings.load(); ring; ring = ring->next) {
+        bool used = false;
+        if (!ring->used.load() && ring->used.compare_exchange_strong(used, true)) {
+            return ring;
+        }
+    }
+
+    // zero-filled
+    RetainedRing* ring = (RetainedRing*)PageAlloc(PAGE_CEILING(sizeof(RetainedRing)));
+    if (ring == nullptr) {
+        return nullptr;
+    }
+
+    ring->used.store(true);
+    RetainedRing* head = sRetainedRings.load();
+    do {
+        ring->next = head;
+    } while (!sRetainedRings.compare_exchange_weak(head, ring));
+
+    return ring;
+}
+
+void RetainedRing::PurgeDue(uint64_t now)
+{
+    // oldest first, stop at first superblock that isn't due
+    for (uint32_t idx = 0; idx < num; ++idx) {
+        RetainedSB& retained = Get(idx);
+        if (now - retained.time < LFMALLOC_DECAY_MS) {
+            break;
+        }
+
+        if (!retained.purged) {
+            STATS_ADD(sbPurgeBytes, retained.size);
+            retained.zeroed = PagePurge(retained.block, retained.size);
+            retained.purged = true;
+        }
+    }
+}
+
+void RetainedRing::Lock()
+{
+    Backoff backoff;
+    while (busy.exchange(true, std::memory_order_acquire)) {
+        backoff.Pause();
+    }
+}
+
+void MapCacheBin::FlushBatch()
+{
+    // untouched superblocks are still zero-filled
+    for (; _blockNum > 0; --_blockNum) {
+        sSbPool[GetNumaIdx(_blockNode)].Free(_block, SB_SIZE, true);
+        _block += SB_SIZE;
+    }
+}
+
+char* SuperblockPool::Alloc(size_t size, bool& zeroed)
+{
+    size_t order = GetOrder(size);
+    // prefer superblocks that may still be backed by pages
+    zeroed = false;
+    Descriptor* desc = Pop(_dirty[order]);
+    if (!desc) {
+        zeroed = true;
+        desc = Pop(_zeroed[order]);
+        if (!desc) {
+            return nullptr;
+        }
+    }
+
+    ASSERT(desc->blockSize == size);
+    char* block = desc->superblock;
+    _bytes.fetch_sub(size);
+    DescRetire(desc);
+    return block;
+}
+
+void SuperblockPool::Free(char* block, size_t size, bool zeroed)
+{
+    // pool is full, last resort is to unmap superblock
+    if (_bytes.fetch_add(size) + size > SB_POOL_CAP / sNumaNodes) {
+        _bytes.fetch_sub(size);
+        STATS_ADD(sbUnmapBytes, size);
+        PageFree(block, size);
+        return;
+    }
+
+    Descriptor* desc = DescAlloc(DESC_LARGE);
+    if (UNLIKELY(desc == nullptr)) {
+        _bytes.fetch_sub(size);
+        STATS_ADD(sbUnmapBytes, size);
+        PageFree(block, size);
+        return;
+    }
+
+    desc->heap = nullptr;
+    desc->superblock = block;
+    desc->blockSize = size;
+
+    size_t order = GetOrder(size);
+    Push(zeroed ? _zeroed[order] : _dirty[order], desc);
+}
+
+size_t SuperblockPool::GetOrder(size_t size)
+{
+    ASSERT((size % SB_SIZE) == 0);
+    size_t order = __builtin_ctzl(size >> LG_SB_SIZE);
+    ASSERT((size_t)SB_SIZE << order == size);
+    ASSERT(order < SB_POOL_ORDERS);
+    return order;
+}
+
+Descriptor* SuperblockPool::Pop(std::atomic<DescriptorNode>& list)
+{
+    DescriptorNode oldHead = list.load();
+    DescriptorNode newHead;
+    do {
+        Descriptor* desc = oldHead.GetDesc();
+        if (!desc) {
+            return nullptr;
+        }
+
+        newHead = desc->nextFree.load();
+        newHead.Set(newHead.GetDesc(), oldHead.GetCounter());
+    } while (!list.compare_exchange_weak(oldHead, newHead));
+
+    return oldHead.GetDesc();
+}
+
+void SuperblockPool::Push(std::atomic<DescriptorNode>& list, Descriptor* desc)
+{
+    DescriptorNode oldHead = list.load();
+    DescriptorNode newHead;
+    do {
+        desc->nextFree.store(oldHead);
+        newHead.Set(desc, oldHead.GetCounter() + 1);
+    } while (!list.compare_exchange_weak(oldHead, newHead));
+}
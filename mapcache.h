@@ -7,53 +7,141 @@
 #ifndef __MAPCACHE_H_
 #define __MAPCACHE_H_
 
+#include <atomic>
+
 #include "log.h"
+#include "lrmalloc_internal.h"
+#include "numa.h"
 #include "pages.h"
 #include "size_classes.h"
 #include <sys/mman.h>
 
 #define MAPCACHE_SIZE 64
+// max number of empty superblocks retained per thread
+// retaining more than this moves the oldest one to the global pool
+#define MAPCACHE_RETAIN 32
+// one pool list per superblock size, SB_SIZE << order
+#define SB_POOL_ORDERS 4
+// max number of bytes held by the global pools of all nodes, beyond that
+//  superblocks are unmapped
+#define SB_POOL_CAP (1ULL << 28)
+// time an empty superblock stays dirty before its pages are purged
+#ifndef LFMALLOC_DECAY_MS
+#define LFMALLOC_DECAY_MS 10000
+#endif
+
+// empty superblock kept mapped for reuse
+struct RetainedSB {
+    char* block;
+    size_t size;
+    // time (ms) superblock was retained
+    uint64_t time;
+    // node superblock is bound to
+    uint32_t node;
+    // pages were purged and are known to be zero-filled
+    bool purged;
+    bool zeroed;
+};
+
+// empty superblocks retained by a thread
+// records live outside of thread local storage and are never freed, so
+//  that other threads can purge the superblocks of an idle thread, or of
+//  one that exited without its hooks running
+struct RetainedRing {
+    // ring buffer of retained superblocks, oldest first
+    uint32_t head;
+    uint32_t num;
+    RetainedSB sbs[MAPCACHE_RETAIN];
+    // held by the owner thread while it uses the ring, and by other
+    //  threads purging the ring's superblocks on its behalf
+    std::atomic<bool> busy;
+    // record belongs to a live thread
+    std::atomic<bool> used;
+    // records are only ever pushed, so the list can be walked without ABA
+    RetainedRing* next;
+
+    // purge superblocks retained for longer than LFMALLOC_DECAY_MS
+    // must hold busy
+    void PurgeDue(uint64_t now);
+    void Lock();
+    void Unlock() { busy.store(false, std::memory_order_release); }
+
+    RetainedSB& Get(uint32_t idx)
+    {
+        return sbs[(head + idx) % MAPCACHE_RETAIN];
+    }
+};
 
 struct MapCacheBin {
 private:
     char* _block = nullptr;
     uint32_t _blockNum = 0;
+    // node the mapped batch is bound to
+    uint32_t _blockNode = 0;
+    // acquired on first superblock retained
+    RetainedRing* _ring = nullptr;
+    // time (ms) of last purge pass
+    uint64_t _lastPurge = 0;
+    // set once Flush ran, superblocks freed afterwards aren't retained
+    bool _finalized = false;
 
 public:
-    // Map MAPCACHE_SIZE superblocks in one go and then consume 1 by 1
-    char* Alloc();
-    // Unmap superblocks immediately in SB_SIZE chunks
-    void Free(char*);
-    // Used for thread termination to unmap what remains
+    // Reuse the most recently retained superblock or one from the global
+    //  pool, otherwise map MAPCACHE_SIZE superblocks in one go and then
+    //  consume 1 by 1
+    // superblocks larger than SB_SIZE are mapped individually
+    // superblocks are always aligned to their size and bound to `node`
+    // `zeroed` is set if the superblock is zero-filled
+    char* Alloc(size_t size, uint32_t node, bool& zeroed);
+    // Retain superblock of `node` for reuse, moving the oldest one to
+    //  the global pool if needed
+    void Free(char* block, size_t size, uint32_t node);
+    // Purge pages of superblocks retained for longer than LFMALLOC_DECAY_MS
+    //  by this thread, and by other threads that may be idle
+    // cheap if no purge is due, meant to be called on slow paths
+    void Decay();
+    // Used for thread termination, hands what remains to the global pool
     void Flush();
+
+private:
+    // hands superblocks left in the mapped batch to the global pool
+    void FlushBatch();
+    // reuse ring of an exited thread, or map a new one
+    static RetainedRing* AcquireRing();
+    // purge due superblocks of all rings, at most once every 1/10th of
+    //  the decay time across all threads
+    // rings in use by their owner are skipped
+    static void DecayAll(uint64_t now);
 };
 
-inline char* MapCacheBin::Alloc()
-{
-    if (_blockNum == 0) {
-        _block = (char*)PageAlloc(SB_SIZE * MAPCACHE_SIZE);
-        if (_block == nullptr) {
-            return nullptr;
-        }
-        _blockNum = MAPCACHE_SIZE;
-    }
-    char* ret = _block;
-    _block += SB_SIZE;
-    _blockNum--;
-    return ret;
-}
-
-inline void MapCacheBin::Free(char* block)
-{
-    PageFree(block, SB_SIZE);
-}
-
-inline void MapCacheBin::Flush()
-{
-    if (_blockNum > 0) {
-        PageFree(_block, SB_SIZE * _blockNum);
-    }
-}
+// process-wide pool of purged superblocks, one per numa node
+// superblocks of SB_SIZE can be recarved for any size class that uses them
+// each list is a lock-free stack of descriptors, linked with nextFree,
+//  describing a superblock (desc->superblock, desc->blockSize)
+struct SuperblockPool {
+private:
+    // superblocks whose pages may still be resident (MADV_FREE)
+    std::atomic<DescriptorNode> _dirty[SB_POOL_ORDERS];
+    // zero-filled superblocks
+    std::atomic<DescriptorNode> _zeroed[SB_POOL_ORDERS];
+    std::atomic<size_t> _bytes;
+
+public:
+    // returns nullptr if no superblock of `size` is available
+    char* Alloc(size_t size, bool& zeroed);
+    // superblock pages must have been purged
+    // unmaps superblock if pool is full, each node gets an equal share
+    //  of SB_POOL_CAP
+    void Free(char* block, size_t size, bool zeroed);
+
+private:
+    static size_t GetOrder(size_t size);
+    Descriptor* Pop(std::atomic<DescriptorNode>& list);
+    void Push(std::atomic<DescriptorNode>& list, Descriptor* desc);
+};
+
+// indexed with GetNumaIdx
+extern SuperblockPool sSbPool[NUMA_MAX_NODES];
 
 // use tls init exec model
 extern __thread MapCacheBin sMapCache LFMALLOC_TLS_INIT_EXEC LFMALLOC_CACHE_ALIGNED;
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+// C++ replaceable allocation functions
+// built with -fexceptions, unlike the rest of the allocator, so that
+//  failed allocations can throw std::bad_alloc
+// sized and aligned deletes skip the pagemap lookup for small blocks
+
+#include <cstddef>
+#include <new>
+
+// before lrmalloc.h, its declarations must come after the system ones
+#include "prof.h"
+#include "lrmalloc.h"
+
+// called when an allocation fails, retries for as long as there's a new
+//  handler, like the default operator new
+// nothrow allocations return nullptr instead of throwing, including if
+//  the handler throws std::bad_alloc
+LFMALLOC_ATTR(noinline) LFMALLOC_PROF_SECTION
+static void* NewRetry(size_t alignment, size_t size, bool nothrow)
+{
+    while (true) {
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            if (nothrow) {
+                return nullptr;
+            }
+
+            throw std::bad_alloc();
+        }
+
+        if (nothrow) {
+            try {
+                handler();
+            } catch (std::bad_alloc const&) {
+                return nullptr;
+            }
+        } else {
+            handler();
+        }
+
+        void* ptr = alignment ? lf_aligned_alloc(alignment, size) : lf_malloc(size);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+    }
+}
+
+LFMALLOC_INLINE
+void* do_new(size_t size, bool nothrow)
+{
+    void* ptr = lf_malloc(size);
+    if (UNLIKELY(ptr == nullptr)) {
+        return NewRetry(0, size, nothrow);
+    }
+
+    return ptr;
+}
+
+LFMALLOC_INLINE
+void* do_new_aligned(size_t alignment, size_t size, bool nothrow)
+{
+    void* ptr = lf_aligned_alloc(alignment, size);
+    if (UNLIKELY(ptr == nullptr)) {
+        return NewRetry(alignment, size, nothrow);
+    }
+
+    return ptr;
+}
+
+LFMALLOC_PROF_SECTION
+void* operator new(size_t size)
+{
+    return do_new(size, false);
+}
+
+LFMALLOC_PROF_SECTION
+void* operator new[](size_t size)
+{
+    return do_new(size, false);
+}
+
+LFMALLOC_PROF_SECTION
+void* operator new(size_t size, std::nothrow_t const&) noexcept
+{
+    return do_new(size, true);
+}
+
+LFMALLOC_PROF_SECTION
+void* operator new[](size_t size, std::nothrow_t const&) noexcept
+{
+    return do_new(size, true);
+}
+
+LFMALLOC_PROF_SECTION
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return do_new_aligned((size_t)alignment, size, false);
+}
+
+LFMALLOC_PROF_SECTION
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return do_new_aligned((size_t)alignment, size, false);
+}
+
+LFMALLOC_PROF_SECTION
+void* operator new(size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept
+{
+    return do_new_aligned((size_t)alignment, size, true);
+}
+
+LFMALLOC_PROF_SECTION
+void* operator new[](size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept
+{
+    return do_new_aligned((size_t)alignment, size, true);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    lf_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    lf_free(ptr);
+}
+
+void operator delete(void* ptr, std::nothrow_t const&) noexcept
+{
+    lf_free(ptr);
+}
+
+void operator delete[](void* ptr, std::nothrow_t const&) noexcept
+{
+    lf_free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept
+{
+    lf_free_sized(ptr, size);
+}
+
+void operator delete[](void* ptr, size_t size) noexcept
+{
+    lf_free_sized(ptr, size);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    lf_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+    lf_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, std::nothrow_t const&) noexcept
+{
+    lf_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, std::nothrow_t const&) noexcept
+{
+    lf_free(ptr);
+}
+
+void operator delete(void* ptr, size_t size, std::align_val_t alignment) noexcept
+{
+    lf_free_aligned_sized(ptr, (size_t)alignment, size);
+}
+
+void operator delete[](void* ptr, size_t size, std::align_val_t alignment) noexcept
+{
+    lf_free_aligned_sized(ptr, (size_t)alignment, size);
+}
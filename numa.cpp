@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#include "numa.h"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+uint32_t sNumaNodes = 1;
+
+void InitNuma()
+{
+#if LFMALLOC_NUMA
+    // node ranges, e.g "0-1\n" or "0,2-3\n"
+    // read with plain syscalls, stdio may allocate
+    int fd = open("/sys/devices/system/node/possible", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    char buf[128];
+    ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    // highest node id is the largest number in the ranges
+    uint32_t maxNode = 0;
+    uint32_t num = 0;
+    for (ssize_t idx = 0; idx < len; ++idx) {
+        if (buf[idx] >= '0' && buf[idx] <= '9') {
+            num = num * 10 + (buf[idx] - '0');
+        } else {
+            maxNode = std::max(maxNode, num);
+            num = 0;
+        }
+    }
+
+    maxNode = std::max(maxNode, num);
+    sNumaNodes = std::min<uint32_t>(maxNode + 1, NUMA_MAX_NODES);
+#endif
+}
+
+#if LFMALLOC_NUMA
+uint32_t GetNumaNode()
+{
+    // vdso call on x86-64, no syscall
+    unsigned int cpu;
+    unsigned int node;
+    if (UNLIKELY(getcpu(&cpu, &node) != 0)) {
+        return 0;
+    }
+
+    return node;
+}
+
+void NumaBind(void* ptr, size_t size, uint32_t node)
+{
+    if (sNumaNodes == 1) {
+        return;
+    }
+
+    // preferred instead of bind, so that allocations fall back to other
+    //  nodes instead of failing when the node runs out of memory
+    // may fail, e.g if mbind is filtered, pages are still usable
+    if (node >= NUMA_MAX_NODE_ID) {
+        return;
+    }
+
+    size_t const bits = sizeof(unsigned long) * 8;
+    unsigned long mask[NUMA_MAX_NODE_ID / (sizeof(unsigned long) * 8)] = {};
+    mask[node / bits] = 1UL << (node % bits);
+    syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, mask, (node / bits + 1) * bits + 1, 0);
+}
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#ifndef __NUMA_H_
+#define __NUMA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "log.h"
+#include "lrmalloc.h"
+
+// if 1, heaps and superblock pools are kept per numa node
+// superblocks are bound to the node of the thread that maps them, and
+//  threads prefer partial superblocks of their own node
+#ifndef LFMALLOC_NUMA
+#define LFMALLOC_NUMA 0
+#endif
+
+// max number of nodes with their own heaps and pools
+// nodes past the max share heaps and pools with lower nodes
+#if LFMALLOC_NUMA
+#define NUMA_MAX_NODES 8
+#else
+#define NUMA_MAX_NODES 1
+#endif
+// node ids past this aren't bound to
+#define NUMA_MAX_NODE_ID 1024
+
+// number of heaps and pools in use, at most NUMA_MAX_NODES
+extern uint32_t sNumaNodes;
+
+// index of the heaps and pools of `node`
+inline uint32_t GetNumaIdx(uint32_t node)
+{
+    return node % sNumaNodes;
+}
+
+// detects number of nodes, must be called before GetNumaNode
+void InitNuma();
+
+#if LFMALLOC_NUMA
+// node of the cpu the calling thread is running on, can be past
+//  NUMA_MAX_NODES
+// threads can migrate, so result is only a hint, meant for slow paths
+uint32_t GetNumaNode();
+// make pages prefer memory of `node`, whichever thread faults them in
+// policy sticks to the pages after they're purged
+void NumaBind(void* ptr, size_t size, uint32_t node);
+#else
+inline uint32_t GetNumaNode()
+{
+    return 0;
+}
+
+inline void NumaBind(void* ptr, size_t size, uint32_t node)
+{
+}
+#endif
+
+#endif // __NUMA_H_
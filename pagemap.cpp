@@ -10,12 +10,25 @@
 #include "pages.h"
 
 PageMap sPageMap;
+#if LFMALLOC_SB_PAGEMAP
+PageMap sSbMap;
+#endif
 
-void PageMap::Init()
+void PageMap::Init(size_t lgGranule)
 {
+    _keyShift = lgGranule;
+#if LFMALLOC_PAGEMAP_RADIX
+    _keyMask = (1ULL << (PM_RADIX_ADDR_BITS - lgGranule)) - 1;
+    // only the root is allocated upfront, other levels are allocated
+    //  as pages get registered
+    _root = (PMRoot*)PageAlloc(PAGE_CEILING(sizeof(PMRoot) << PM_RADIX_ROOT_BITS(lgGranule)));
+    ASSERT(_root);
+#else
+    _keyMask = (1ULL << (64 - PM_NHS - lgGranule)) - 1;
     // pages will necessarily be given by the OS
     // so they're already initialized and zero'd
     // PM_SZ is necessarily aligned to page size
-    _pagemap = (std::atomic<PageInfo>*)PageAllocOvercommit(PM_SZ);
+    _pagemap = (std::atomic<PageInfo>*)PageAllocOvercommit(PM_SZ(lgGranule));
     ASSERT(_pagemap);
+#endif
 }
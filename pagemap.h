@@ -11,8 +11,24 @@
 
 #include "log.h"
 #include "lrmalloc.h"
+#include "pages.h"
 #include "size_classes.h"
 
+// if 1, the pagemap is a 3-level radix tree with lazily allocated nodes
+//  instead of a flat array reserved upfront
+// the radix tree doesn't rely on overcommit and supports 57-bit
+//  addresses (5-level paging), at the cost of 2 extra loads per lookup
+#ifndef LFMALLOC_PAGEMAP_RADIX
+#define LFMALLOC_PAGEMAP_RADIX 0
+#endif
+
+// if 1, superblocks are registered in a separate superblock-granular map
+//  (sSbMap), with a single entry per SB_SIZE
+// large allocations are still registered per page in sPageMap
+#ifndef LFMALLOC_SB_PAGEMAP
+#define LFMALLOC_SB_PAGEMAP 1
+#endif
+
 // assuming x86-64, for now
 // which uses 48 bits for addressing (e.g high 16 bits ignored)
 // can ignore the bottom 12 bits (lg of page)
@@ -25,6 +41,7 @@
 // to get the key from a address
 // 1. shift to remove insignificant low bits
 // 2. apply mask of middle significant bits
+// maps with a coarser granularity (e.g sSbMap) ignore more low bits
 #define PM_KEY_SHIFT PM_NLS
 #define PM_KEY_MASK ((1ULL << PM_SB) - 1)
 
@@ -71,30 +88,148 @@ inline size_t PageInfo::GetScIdx() const
     return ((size_t)_desc & SC_MASK);
 }
 
-#define PM_SZ ((1ULL << PM_SB) * sizeof(PageInfo))
+// size of array-based map with 2^lg bytes per entry
+#define PM_SZ(lg) ((1ULL << (64 - PM_NHS - (lg))) * sizeof(PageInfo))
 
 static_assert(sizeof(PageInfo) == sizeof(uint64_t), "Invalid PageInfo size");
 
+// radix tree layout
+// significant address bits, enough for 5-level paging
+#define PM_RADIX_ADDR_BITS 57
+// a leaf covers 2^15 entries, e.g 128MB of address space in pages
+#define PM_RADIX_LEAF_BITS 15
+#define PM_RADIX_MID_BITS 15
+// root covers the remaining bits of a map with 2^lg bytes per entry
+#define PM_RADIX_ROOT_BITS(lg) (PM_RADIX_ADDR_BITS - (lg) - PM_RADIX_MID_BITS - PM_RADIX_LEAF_BITS)
+
+// radix tree nodes, each level is an array of atomic ptrs to the next
+typedef std::atomic<PageInfo> PMLeaf;
+typedef std::atomic<PMLeaf*> PMMid;
+typedef std::atomic<PMMid*> PMRoot;
+
+// install a zero-filled node of `size` bytes in an empty slot
+// returns the installed node, which can be a concurrently installed one
+// returns nullptr if out of memory, slot is left empty
+template <typename T>
+T* InstallNode(std::atomic<T*>& slot, size_t size)
+{
+    T* node = (T*)PageAlloc(size);
+    if (UNLIKELY(node == nullptr)) {
+        return nullptr;
+    }
+
+    T* expected = nullptr;
+    if (!slot.compare_exchange_strong(expected, node)) {
+        // lost race, use winner's node
+        PageFree(node, size);
+        return expected;
+    }
+
+    return node;
+}
+
 // lock free page map
 class PageMap {
 public:
     // must be called before any GetPageInfo/SetPageInfo calls
-    void Init();
+    // each entry covers 2^lgGranule bytes, LG_PAGE for a page map
+    void Init(size_t lgGranule);
 
     PageInfo GetPageInfo(char* ptr);
-    void SetPageInfo(char* ptr, PageInfo info);
+    // returns false if out of memory, only possible when registering a
+    //  descriptor in a radix tree range that was never used
+    bool SetPageInfo(char* ptr, PageInfo info);
 
 private:
     size_t AddrToKey(char* ptr) const;
+#if LFMALLOC_PAGEMAP_RADIX
+    // returns leaf array holding key, or nullptr if it doesn't exist
+    //  and create is false, or if out of memory
+    PMLeaf* GetLeaf(size_t key, bool create);
+#endif
 
 private:
+    size_t _keyShift = PM_KEY_SHIFT;
+    size_t _keyMask = PM_KEY_MASK;
+#if LFMALLOC_PAGEMAP_RADIX
+    // radix tree impl
+    PMRoot* _root = { nullptr };
+#else
     // array based impl
     std::atomic<PageInfo>* _pagemap = { nullptr };
+#endif
 };
 
+#if LFMALLOC_PAGEMAP_RADIX
+
+inline size_t PageMap::AddrToKey(char* ptr) const
+{
+    size_t key = ((size_t)ptr >> _keyShift) & _keyMask;
+    return key;
+}
+
+inline PageInfo PageMap::GetPageInfo(char* ptr)
+{
+    size_t key = AddrToKey(ptr);
+    PMLeaf* leaf = GetLeaf(key, false);
+    if (UNLIKELY(leaf == nullptr)) {
+        // no page in the leaf range was ever registered
+        PageInfo info;
+        info.Set(nullptr, 0);
+        return info;
+    }
+
+    return leaf[key & ((1ULL << PM_RADIX_LEAF_BITS) - 1)].load();
+}
+
+inline bool PageMap::SetPageInfo(char* ptr, PageInfo info)
+{
+    size_t key = AddrToKey(ptr);
+    // clearing an entry never needs new nodes
+    bool create = info.GetDesc() != nullptr;
+    PMLeaf* leaf = GetLeaf(key, create);
+    if (UNLIKELY(leaf == nullptr)) {
+        return !create;
+    }
+
+    leaf[key & ((1ULL << PM_RADIX_LEAF_BITS) - 1)].store(info);
+    return true;
+}
+
+inline PMLeaf* PageMap::GetLeaf(size_t key, bool create)
+{
+    size_t rootIdx = key >> (PM_RADIX_MID_BITS + PM_RADIX_LEAF_BITS);
+    size_t midIdx = (key >> PM_RADIX_LEAF_BITS) & ((1ULL << PM_RADIX_MID_BITS) - 1);
+
+    PMMid* mid = _root[rootIdx].load();
+    if (UNLIKELY(mid == nullptr)) {
+        if (!create) {
+            return nullptr;
+        }
+
+        mid = InstallNode(_root[rootIdx], sizeof(PMMid) << PM_RADIX_MID_BITS);
+        if (UNLIKELY(mid == nullptr)) {
+            return nullptr;
+        }
+    }
+
+    PMLeaf* leaf = mid[midIdx].load();
+    if (UNLIKELY(leaf == nullptr)) {
+        if (!create) {
+            return nullptr;
+        }
+
+        leaf = InstallNode(mid[midIdx], sizeof(PMLeaf) << PM_RADIX_LEAF_BITS);
+    }
+
+    return leaf;
+}
+
+#else
+
 inline size_t PageMap::AddrToKey(char* ptr) const
 {
-    size_t key = ((size_t)ptr >> PM_KEY_SHIFT) & PM_KEY_MASK;
+    size_t key = ((size_t)ptr >> _keyShift) & _keyMask;
     return key;
 }
 
@@ -104,12 +239,18 @@ inline PageInfo PageMap::GetPageInfo(char* ptr)
     return _pagemap[key].load();
 }
 
-inline void PageMap::SetPageInfo(char* ptr, PageInfo info)
+inline bool PageMap::SetPageInfo(char* ptr, PageInfo info)
 {
     size_t key = AddrToKey(ptr);
     _pagemap[key].store(info);
+    return true;
 }
 
+#endif
+
 extern PageMap sPageMap;
+#if LFMALLOC_SB_PAGEMAP
+extern PageMap sSbMap;
+#endif
 
 #endif // __PAGEMAP_H
@@ -6,6 +6,8 @@
 
 #include "pages.h"
 
+#include <algorithm>
+
 #include <sys/mman.h>
 
 #include "log.h"
@@ -22,6 +24,54 @@ void* PageAlloc(size_t size)
     return ptr;
 }
 
+void* PageAllocAligned(size_t size, size_t align)
+{
+    ASSERT((size & PAGE_MASK) == 0);
+    ASSERT((align & PAGE_MASK) == 0);
+
+    // optimistic case, OS already gave us an aligned map
+    char* ptr = (char*)PageAlloc(size);
+    if (ptr == nullptr || ((size_t)ptr & (align - 1)) == 0) {
+        return ptr;
+    }
+
+    PageFree(ptr, size);
+
+    // over-allocate and trim excess pages on both sides
+    ptr = (char*)PageAlloc(size + align - PAGE);
+    if (ptr == nullptr) {
+        return nullptr;
+    }
+
+    char* ret = ALIGN_ADDR(ptr, align);
+    size_t head = ret - ptr;
+    size_t tail = (align - PAGE) - head;
+    if (head > 0) {
+        PageFree(ptr, head);
+    }
+
+    if (tail > 0) {
+        PageFree(ret + size, tail);
+    }
+
+    return ret;
+}
+
+void* PageAllocHuge(size_t size, size_t align)
+{
+    if (!LFMALLOC_HUGEPAGE || size < HUGEPAGE) {
+        return PageAllocAligned(size, align);
+    }
+
+    void* ptr = PageAllocAligned(size, std::max(align, HUGEPAGE));
+    if (ptr != nullptr) {
+        // may fail if THP is disabled, pages are still usable
+        madvise(ptr, size, MADV_HUGEPAGE);
+    }
+
+    return ptr;
+}
+
 void* PageAllocOvercommit(size_t size)
 {
     ASSERT((size & PAGE_MASK) == 0);
@@ -38,6 +88,42 @@ void* PageAllocOvercommit(size_t size)
     return ptr;
 }
 
+bool PageGrow(void* ptr, size_t oldSize, size_t newSize)
+{
+    ASSERT((oldSize & PAGE_MASK) == 0);
+    ASSERT((newSize & PAGE_MASK) == 0);
+
+    return mremap(ptr, oldSize, newSize, 0) != MAP_FAILED;
+}
+
+bool PageMove(void* ptr, size_t oldSize, void* target, size_t newSize)
+{
+    ASSERT((oldSize & PAGE_MASK) == 0);
+    ASSERT((newSize & PAGE_MASK) == 0);
+
+    void* ret = mremap(ptr, oldSize, newSize, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+    return ret != MAP_FAILED;
+}
+
+bool PagePurge(void* ptr, size_t size)
+{
+    ASSERT((size & PAGE_MASK) == 0);
+
+#ifdef MADV_FREE
+    // lazy, pages are only reclaimed under memory pressure
+    // but content is undefined until then
+    if (madvise(ptr, size, MADV_FREE) == 0) {
+        return false;
+    }
+#endif
+
+    // MADV_FREE not supported, pages are dropped immediately
+    int ret = madvise(ptr, size, MADV_DONTNEED);
+    (void)ret; // suppress warning
+    ASSERT(ret == 0);
+    return true;
+}
+
 void PageFree(void* ptr, size_t size)
 {
     ASSERT((size & PAGE_MASK) == 0);
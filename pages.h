@@ -15,11 +15,34 @@
 // return page address for page containing a
 #define PAGE_ADDR2BASE(a) ((void*)((uintptr)(a) & ~PAGE_MASK))
 
+// if 1, superblock batches and large allocations of at least HUGEPAGE
+//  bytes are hugepage aligned and advised as MADV_HUGEPAGE
+#ifndef LFMALLOC_HUGEPAGE
+#define LFMALLOC_HUGEPAGE 0
+#endif
+
 // returns a set of continous pages, totaling to size bytes
 void* PageAlloc(size_t size);
+// same as PageAlloc, but first page is aligned to align
+// align must be a power of two multiple of PAGE
+void* PageAllocAligned(size_t size, size_t align);
+// same as PageAllocAligned, but backed by transparent huge pages if enabled
+void* PageAllocHuge(size_t size, size_t align);
 // explictely allow overcommiting
 // used for array-based page map
 void* PageAllocOvercommit(size_t size);
+// grow a set of continous pages in place
+// returns false if the pages that follow aren't free, in which case the
+//  pages are left untouched
+bool PageGrow(void* ptr, size_t oldSize, size_t newSize);
+// move a set of continous pages to `target`, a mapping of newSize bytes
+//  that is replaced, and grow them to newSize
+// returns false on failure, in which case both are left untouched
+bool PageMove(void* ptr, size_t oldSize, void* target, size_t newSize);
+// release physical pages backing a set of continous pages, which stay
+//  mapped and can be reused
+// returns true if pages are now known to be zero-filled
+bool PagePurge(void* ptr, size_t size);
 // free a set of continous pages, totaling to size bytes
 void PageFree(void* ptr, size_t size);
 
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#include "percpu.h"
+
+#include <algorithm>
+
+#include <sys/sysinfo.h>
+
+#include "pages.h"
+
+bool sPerCpu = false;
+char* sPerCpuRegion = nullptr;
+uint32_t sPerCpuCap[MAX_SZ_IDX] = { 0 };
+
+void InitPerCpu()
+{
+#if LFMALLOC_PERCPU
+    // glibc didn't register rseq, e.g disabled with
+    //  GLIBC_TUNABLES=glibc.pthread.rseq=0 or older glibc
+    if (&__rseq_size == nullptr || __rseq_size == 0) {
+        return;
+    }
+
+    if ((int32_t)GetRseqArea()->cpuId < 0) {
+        return;
+    }
+
+    // slots of all size classes, right after the bins
+    size_t slot = (sizeof(PerCpuBin) * MAX_SZ_IDX) / sizeof(char*);
+    uint32_t begin[MAX_SZ_IDX] = { 0 };
+    for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
+        SizeClassData* sc = &SizeClasses[scIdx];
+        size_t cap = PERCPU_CLASS_SZ / sc->blockSize;
+        cap = std::min<size_t>(cap, sc->cacheBlockNum);
+        sPerCpuCap[scIdx] = std::max<size_t>(cap, 1);
+
+        begin[scIdx] = slot;
+        slot += sPerCpuCap[scIdx];
+    }
+
+    ASSERT(slot * sizeof(char*) <= PERCPU_REGION_SZ);
+
+    // cpu ids are always lower than the number of configured cpus
+    // may allocate, so can only be done once malloc is initialized
+    size_t cpuNum = get_nprocs_conf();
+    char* region = (char*)PageAllocOvercommit(cpuNum * PERCPU_REGION_SZ);
+    if (region == nullptr) {
+        return;
+    }
+
+    // only bins are written, slots are faulted in as they're used
+    for (size_t cpu = 0; cpu < cpuNum; ++cpu) {
+        PerCpuBin* bins = (PerCpuBin*)(region + cpu * PERCPU_REGION_SZ);
+        for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
+            bins[scIdx].begin = begin[scIdx];
+            bins[scIdx].cur = begin[scIdx];
+            bins[scIdx].end = begin[scIdx] + sPerCpuCap[scIdx];
+        }
+    }
+
+    sPerCpuRegion = region;
+    sPerCpu = true;
+#endif
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#ifndef __PERCPU_H_
+#define __PERCPU_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "log.h"
+#include "lrmalloc.h"
+#include "size_classes.h"
+
+// if 1, small blocks are cached per cpu instead of per thread, so memory
+//  held in caches scales with the number of cpus instead of threads
+// relies on restartable sequences (rseq) registered by glibc, if these
+//  aren't available threads use per-thread caches instead
+#ifndef LFMALLOC_PERCPU
+#define LFMALLOC_PERCPU 0
+#endif
+
+#if LFMALLOC_PERCPU && !defined(__x86_64__)
+#error "per-cpu caches are only implemented for x86-64"
+#endif
+
+// max bytes cached per size class, per cpu, at least 1 block
+#define PERCPU_CLASS_SZ (1ULL << 16)
+// each cpu has a region with a PerCpuBin per size class, followed by
+//  the block slots of all size classes
+#define LG_PERCPU_REGION_SZ 18
+#define PERCPU_REGION_SZ (1ULL << LG_PERCPU_REGION_SZ)
+
+// cache of a size class in a cpu region
+// slots [begin, cur) of the region hold cached blocks
+struct PerCpuBin {
+    uint32_t cur;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t pad;
+};
+
+// kernel rseq area, only the fields used here
+struct RseqArea {
+    uint32_t cpuIdStart;
+    uint32_t cpuId;
+    uint64_t rseqCs;
+    uint32_t flags;
+};
+
+// set once per-cpu caches are ready to use
+extern bool sPerCpu;
+extern char* sPerCpuRegion;
+// max number of blocks in a per-cpu cache, per size class
+extern uint32_t sPerCpuCap[MAX_SZ_IDX];
+
+// enables per-cpu caches if rseq is available
+void InitPerCpu();
+
+// number of blocks moved at once between a cpu cache and superblocks
+inline uint32_t PerCpuBatch(size_t scIdx)
+{
+    uint32_t batch = sPerCpuCap[scIdx] / 2;
+    return batch ? batch : 1;
+}
+
+#if LFMALLOC_PERCPU
+
+extern "C" {
+// exported by glibc >= 2.35, weak so that older versions still link
+extern const ptrdiff_t __rseq_offset LFMALLOC_ATTR(weak);
+extern const unsigned int __rseq_size LFMALLOC_ATTR(weak);
+}
+
+// rseq area glibc registered for the calling thread
+inline RseqArea* GetRseqArea()
+{
+    return (RseqArea*)((char*)__builtin_thread_pointer() + __rseq_offset);
+}
+
+// rseq critical section [1, 2) with abort handler 4, descriptor at 3
+// the abort handler restarts at 7, the kernel clears rseqCs before
+//  jumping to it, so the section must be armed again
+#define PERCPU_RSEQ_CS                                           \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                         \
+    ".balign 32\n\t"                                             \
+    "3:\n\t"                                                     \
+    ".long 0x0, 0x0\n\t"                                         \
+    ".quad 1f, (2f - 1f), 4f\n\t"                                \
+    ".popsection\n\t"                                            \
+    "7:\n\t"                                                     \
+    "leaq 3b(%%rip), %%rax\n\t"                                  \
+    "movq %%rax, %[rseqCs]\n\t"
+
+// handler is preceded by the signature glibc registered rseq with
+#define PERCPU_RSEQ_ABORT                                        \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                    \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                 \
+    ".long 0x53053053\n\t"                                       \
+    "4:\n\t"                                                     \
+    "jmp 7b\n\t"                                                 \
+    ".popsection\n\t"
+
+// pop most recently cached block from the current cpu cache
+// can return nullptr if the cache is empty
+inline char* PerCpuPop(size_t scIdx)
+{
+    RseqArea* rs = GetRseqArea();
+    char* ret;
+    asm volatile(
+        PERCPU_RSEQ_CS
+        "1:\n\t"
+        "movl %[cpuId], %%eax\n\t"
+        "shlq %[shift], %%rax\n\t"
+        "addq %[region], %%rax\n\t"
+        "movl (%%rax, %[bin]), %%ecx\n\t"
+        "cmpl 4(%%rax, %[bin]), %%ecx\n\t"
+        "je 5f\n\t"
+        "movq -8(%%rax, %%rcx, 8), %[ret]\n\t"
+        "decl %%ecx\n\t"
+        // commit
+        "movl %%ecx, (%%rax, %[bin])\n\t"
+        "2:\n\t"
+        "jmp 6f\n\t"
+        "5:\n\t"
+        "xorl %k[ret], %k[ret]\n\t"
+        "6:\n\t"
+        PERCPU_RSEQ_ABORT
+        : [ret] "=&r"(ret), [rseqCs] "=m"(rs->rseqCs)
+        : [cpuId] "m"(rs->cpuId), [region] "r"(sPerCpuRegion),
+        [bin] "r"(scIdx * sizeof(PerCpuBin)), [shift] "i"(LG_PERCPU_REGION_SZ)
+        : "rax", "rcx", "memory", "cc");
+    return ret;
+}
+
+// push block to the current cpu cache
+// returns false if the cache is full
+inline bool PerCpuPush(size_t scIdx, char* block)
+{
+    RseqArea* rs = GetRseqArea();
+    uint32_t ret;
+    asm volatile(
+        PERCPU_RSEQ_CS
+        "1:\n\t"
+        "movl %[cpuId], %%eax\n\t"
+        "shlq %[shift], %%rax\n\t"
+        "addq %[region], %%rax\n\t"
+        "movl (%%rax, %[bin]), %%ecx\n\t"
+        "cmpl 8(%%rax, %[bin]), %%ecx\n\t"
+        "je 5f\n\t"
+        "movq %[block], (%%rax, %%rcx, 8)\n\t"
+        "incl %%ecx\n\t"
+        // commit
+        "movl %%ecx, (%%rax, %[bin])\n\t"
+        "2:\n\t"
+        "movl $1, %[ret]\n\t"
+        "jmp 6f\n\t"
+        "5:\n\t"
+        "xorl %[ret], %[ret]\n\t"
+        "6:\n\t"
+        PERCPU_RSEQ_ABORT
+        : [ret] "=&r"(ret), [rseqCs] "=m"(rs->rseqCs)
+        : [cpuId] "m"(rs->cpuId), [region] "r"(sPerCpuRegion),
+        [bin] "r"(scIdx * sizeof(PerCpuBin)), [shift] "i"(LG_PERCPU_REGION_SZ),
+        [block] "r"(block)
+        : "rax", "rcx", "memory", "cc");
+    return ret;
+}
+
+#undef PERCPU_RSEQ_CS
+#undef PERCPU_RSEQ_ABORT
+
+#endif // LFMALLOC_PERCPU
+
+#endif // __PERCPU_H_
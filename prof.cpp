@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#include "prof.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// for ENOENT
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <unwind.h>
+
+#include "lrmalloc.h"
+#include "pages.h"
+
+__thread int64_t sProfBytesLeft = 0;
+size_t sProfRate = 0;
+// state of the calling thread's random number generator
+static __thread uint64_t sProfSeed LFMALLOC_TLS_INIT_EXEC = 0;
+// live samples, open addressing by ptr
+static ProfSample* sProfTable = nullptr;
+std::atomic<uint32_t>* sProfFilter = nullptr;
+// number of heap profiles dumped on signal
+static std::atomic<uint32_t> sProfDumps({ 0 });
+
+// writes `val` in `base` (at most 16) to `buf` without a terminating
+//  null, `buf` must hold 20 chars
+// returns number of chars written
+// snprintf isn't async-signal-safe, this is used by signal handlers
+static size_t ProfFormat(char* buf, uint64_t val, uint32_t base)
+{
+    char digits[20];
+    size_t len = 0;
+    do {
+        digits[len++] = "0123456789abcdef"[val % base];
+        val /= base;
+    } while (val != 0);
+
+    for (size_t idx = 0; idx < len; ++idx) {
+        buf[idx] = digits[len - 1 - idx];
+    }
+
+    return len;
+}
+
+#if LFMALLOC_PROF
+static void ProfSignal(int signo)
+{
+    // open, write and close are async-signal-safe, and so is dumping
+    //  as the sample table is lock-free
+    // path is lrmalloc.<pid>.<dump>.heap
+    char path[64];
+    size_t len = 0;
+    memcpy(path, "lrmalloc.", 9);
+    len += 9;
+    len += ProfFormat(path + len, (uint64_t)getpid(), 10);
+    path[len++] = '.';
+    len += ProfFormat(path + len, sProfDumps.fetch_add(1), 10);
+    memcpy(path + len, ".heap", 6);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+
+    lf_prof_dump(fd);
+    close(fd);
+}
+#endif
+
+void InitProf()
+{
+#if LFMALLOC_PROF
+    // getenv doesn't allocate
+    const char* rate = getenv("LFMALLOC_PROF_RATE");
+    if (rate == nullptr || strtoul(rate, nullptr, 10) == 0) {
+        return;
+    }
+
+    // only touched pages of the table are backed by memory
+    sProfTable = (ProfSample*)PageAllocOvercommit(PAGE_CEILING(PROF_TABLE_SIZE * sizeof(ProfSample)));
+    sProfFilter = (std::atomic<uint32_t>*)PageAllocOvercommit(PAGE_CEILING(PROF_FILTER_SIZE * sizeof(uint32_t)));
+    if (sProfTable == nullptr || sProfFilter == nullptr) {
+        sProfTable = nullptr;
+        return;
+    }
+
+    const char* signo = getenv("LFMALLOC_PROF_SIGNAL");
+    if (signo != nullptr) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = ProfSignal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(atoi(signo), &sa, nullptr);
+    }
+
+    sProfRate = strtoul(rate, nullptr, 10);
+#endif
+}
+
+bool ProfNextSample()
+{
+    if (sProfRate == 0) {
+        // never sample again, a thread can't allocate INT64_MAX bytes
+        sProfBytesLeft = INT64_MAX;
+        return false;
+    }
+
+    if (UNLIKELY(sProfSeed == 0)) {
+        sProfSeed = (uint64_t)&sProfSeed ^ ((uint64_t)getpid() << 32) ^ 0x9E3779B97F4A7C15ULL;
+    }
+
+    // xorshift64
+    sProfSeed ^= sProfSeed << 13;
+    sProfSeed ^= sProfSeed >> 7;
+    sProfSeed ^= sProfSeed << 17;
+
+    // sampling is a poisson process over allocated bytes, so the bytes
+    //  between samples are exponentially distributed
+    // u in ]0, 1]
+    double u = ((sProfSeed >> 11) + 1) * (1.0 / (1ULL << 53));
+    sProfBytesLeft = (int64_t)(-std::log(u) * sProfRate);
+    return true;
+}
+
+static size_t ProfHash(char* ptr)
+{
+    // small blocks of a page are spread over the table too
+    return ((uint64_t)ptr * 0x9E3779B97F4A7C15ULL) >> (64 - LG_PROF_TABLE_SIZE);
+}
+
+static ProfSample* ProfFind(char* ptr)
+{
+    size_t idx = ProfHash(ptr);
+    for (size_t probe = 0; probe < PROF_MAX_PROBE; ++probe) {
+        ProfSample* sample = &sProfTable[(idx + probe) % PROF_TABLE_SIZE];
+        char* curr = sample->ptr.load();
+        if (curr == ptr) {
+            return sample;
+        }
+
+        // never used slot ends the probe sequence
+        if (curr == nullptr) {
+            return nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+static ProfSample* ProfClaim(char* ptr)
+{
+    size_t idx = ProfHash(ptr);
+    for (size_t probe = 0; probe < PROF_MAX_PROBE; ++probe) {
+        ProfSample* sample = &sProfTable[(idx + probe) % PROF_TABLE_SIZE];
+        char* curr = sample->ptr.load();
+        if ((curr == nullptr || curr == PROF_TOMBSTONE)
+            && sample->ptr.compare_exchange_strong(curr, PROF_BUSY)) {
+            return sample;
+        }
+    }
+
+    // table is full around `ptr`, sample is dropped
+    return nullptr;
+}
+
+struct ProfTrace {
+    void** stack;
+    uint32_t depth;
+    // still unwinding allocator frames
+    bool inAlloc;
+};
+
+// bounds of LFMALLOC_PROF_SECTION, defined by the linker
+// hidden, so that they're the bounds of this library's section
+extern "C" char __start_lrmalloc_alloc[] LFMALLOC_ATTR(visibility("hidden"));
+extern "C" char __stop_lrmalloc_alloc[] LFMALLOC_ATTR(visibility("hidden"));
+
+// frames of LFMALLOC_PROF_SECTION fns are left out of stack traces
+// the exact number varies with inlining and tail calls, and fn addresses
+//  taken here may be plt entries, so frames are told apart by address
+// `ip` is a return address, the call is right before it
+static bool IsAllocFrame(uintptr_t ip)
+{
+    return ip - 1 >= (uintptr_t)__start_lrmalloc_alloc && ip - 1 < (uintptr_t)__stop_lrmalloc_alloc;
+}
+
+static _Unwind_Reason_Code ProfUnwind(struct _Unwind_Context* ctx, void* arg)
+{
+    ProfTrace* trace = (ProfTrace*)arg;
+    void* ip = (void*)_Unwind_GetIP(ctx);
+    if (trace->inAlloc) {
+        if (IsAllocFrame((uintptr_t)ip)) {
+            return _URC_NO_REASON;
+        }
+
+        trace->inAlloc = false;
+    }
+
+    if (ip == nullptr || trace->depth == PROF_MAX_DEPTH) {
+        return _URC_END_OF_STACK;
+    }
+
+    trace->stack[trace->depth++] = ip;
+    return _URC_NO_REASON;
+}
+
+LFMALLOC_ATTR(noinline) LFMALLOC_PROF_SECTION
+void ProfRecord(char* ptr, size_t size)
+{
+    ProfSample* sample = ProfClaim(ptr);
+    if (sample == nullptr) {
+        return;
+    }
+
+    ProfTrace trace = { sample->stack, 0, true };
+    _Unwind_Backtrace(ProfUnwind, &trace);
+    sample->size = size;
+    sample->depth = trace.depth;
+    sProfFilter[ProfFilterIdx(ptr)].fetch_add(1);
+    sample->ptr.store(ptr);
+}
+
+bool ProfRemove(char* ptr)
+{
+    ProfSample* sample = ProfFind(ptr);
+    if (sample == nullptr) {
+        return false;
+    }
+
+    sample->ptr.store(PROF_TOMBSTONE);
+    sProfFilter[ProfFilterIdx(ptr)].fetch_sub(1);
+    return true;
+}
+
+void ProfMove(char* ptr, char* newPtr, size_t size)
+{
+    ProfSample* sample = ProfFind(ptr);
+    if (sample == nullptr) {
+        return;
+    }
+
+    if (newPtr == ptr) {
+        sample->size = size;
+        return;
+    }
+
+    ProfSample* newSample = ProfClaim(newPtr);
+    if (newSample != nullptr) {
+        // stack of the original allocation is kept
+        newSample->depth = sample->depth;
+        memcpy(newSample->stack, sample->stack, sample->depth * sizeof(void*));
+        newSample->size = size;
+        sProfFilter[ProfFilterIdx(newPtr)].fetch_add(1);
+        newSample->ptr.store(newPtr);
+    }
+
+    sample->ptr.store(PROF_TOMBSTONE);
+    sProfFilter[ProfFilterIdx(ptr)].fetch_sub(1);
+}
+
+// buffered writes to a file descriptor, without allocating
+struct ProfWriter {
+    int fd;
+    size_t pos;
+    char buf[4096];
+
+    void Flush()
+    {
+        size_t done = 0;
+        while (done < pos) {
+            ssize_t ret = write(fd, buf + done, pos - done);
+            if (ret <= 0) {
+                break;
+            }
+
+            done += ret;
+        }
+
+        pos = 0;
+    }
+
+    void Write(const char* str, size_t len)
+    {
+        while (len > 0) {
+            if (pos == sizeof(buf)) {
+                Flush();
+            }
+
+            size_t num = std::min(len, sizeof(buf) - pos);
+            memcpy(buf + pos, str, num);
+            pos += num;
+            str += num;
+            len -= num;
+        }
+    }
+
+    void Write(const char* str)
+    {
+        Write(str, strlen(str));
+    }
+
+    // `val` in decimal, right aligned to `width` chars
+    void WriteDec(uint64_t val, size_t width = 0)
+    {
+        char num[20];
+        size_t len = ProfFormat(num, val, 10);
+        for (; width > len; --width) {
+            Write(" ", 1);
+        }
+
+        Write(num, len);
+    }
+
+    // `val` in hex with a 0x prefix, like %p
+    void WriteHex(uint64_t val)
+    {
+        char num[20];
+        size_t len = ProfFormat(num, val, 16);
+        Write("0x", 2);
+        Write(num, len);
+    }
+};
+
+extern "C" int lf_prof_dump(int fd) noexcept
+{
+    LOG_DEBUG();
+    if (sProfTable == nullptr) {
+        return ENOENT;
+    }
+
+    // a sample can be freed while it's read, its slot is skipped if
+    //  it changed in the meantime
+    uint64_t objs = 0;
+    uint64_t bytes = 0;
+    for (size_t idx = 0; idx < PROF_TABLE_SIZE; ++idx) {
+        ProfSample* sample = &sProfTable[idx];
+        char* ptr = sample->ptr.load();
+        if (ptr > PROF_TOMBSTONE) {
+            objs++;
+            bytes += sample->size;
+        }
+    }
+
+    // legacy heap profile format, understood by pprof
+    ProfWriter out;
+    out.fd = fd;
+    out.pos = 0;
+    out.Write("heap profile: ");
+    out.WriteDec(objs);
+    out.Write(": ");
+    out.WriteDec(bytes);
+    out.Write(" [");
+    out.WriteDec(objs);
+    out.Write(": ");
+    out.WriteDec(bytes);
+    out.Write("] @ heap_v2/");
+    out.WriteDec(sProfRate);
+    out.Write("\n");
+
+    for (size_t idx = 0; idx < PROF_TABLE_SIZE; ++idx) {
+        ProfSample* sample = &sProfTable[idx];
+        char* ptr = sample->ptr.load();
+        if (ptr <= PROF_TOMBSTONE) {
+            continue;
+        }
+
+        ProfSample copy;
+        copy.size = sample->size;
+        copy.depth = std::min<uint32_t>(sample->depth, PROF_MAX_DEPTH);
+        memcpy(copy.stack, sample->stack, copy.depth * sizeof(void*));
+        if (sample->ptr.load() != ptr) {
+            continue;
+        }
+
+        out.WriteDec(1, 8);
+        out.Write(": ");
+        out.WriteDec(copy.size, 8);
+        out.Write(" [");
+        out.WriteDec(1, 8);
+        out.Write(": ");
+        out.WriteDec(copy.size, 8);
+        out.Write("] @");
+        for (uint32_t frame = 0; frame < copy.depth; ++frame) {
+            out.Write(" ");
+            out.WriteHex((uint64_t)copy.stack[frame]);
+        }
+
+        out.Write("\n", 1);
+    }
+
+    // pprof needs the mappings to symbolize addresses
+    out.Write("\nMAPPED_LIBRARIES:\n");
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        out.Flush();
+        ssize_t len;
+        while ((len = read(maps, out.buf, sizeof(out.buf))) > 0) {
+            out.pos = len;
+            out.Flush();
+        }
+
+        close(maps);
+    }
+
+    out.Flush();
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#ifndef __PROF_H_
+#define __PROF_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "log.h"
+#include "lrmalloc.h"
+
+// if 1, allocations can be sampled with their stack traces and live
+//  samples dumped as a pprof heap profile, see lf_prof_dump
+// sampling is enabled at runtime by setting LFMALLOC_PROF_RATE to the
+//  mean number of bytes between samples, otherwise malloc pays a single
+//  never-taken branch
+#ifndef LFMALLOC_PROF
+#define LFMALLOC_PROF 0
+#endif
+
+// max number of live samples, samples beyond that are dropped
+#define LG_PROF_TABLE_SIZE 16
+#define PROF_TABLE_SIZE (1 << LG_PROF_TABLE_SIZE)
+// max number of slots looked at to find a sample
+#define PROF_MAX_PROBE 64
+// max number of frames recorded per sample
+#define PROF_MAX_DEPTH 32
+// number of live sample counters, see ProfMaybeSampled
+#define LG_PROF_FILTER_SIZE 18
+#define PROF_FILTER_SIZE (1 << LG_PROF_FILTER_SIZE)
+
+// sampled allocation
+// `ptr` is nullptr for never used slots, PROF_TOMBSTONE for slots of
+//  freed samples and PROF_BUSY while the slot is written
+struct ProfSample {
+    std::atomic<char*> ptr;
+    size_t size;
+    uint32_t depth;
+    void* stack[PROF_MAX_DEPTH];
+};
+
+#define PROF_BUSY ((char*)1)
+#define PROF_TOMBSTONE ((char*)2)
+
+// allocation entry points, and the fns between them and ProfRecord, go
+//  in this section, so that their frames are left out of stack traces
+#define LFMALLOC_PROF_SECTION LFMALLOC_ATTR(section("lrmalloc_alloc"))
+
+// bytes the calling thread can allocate before the next sample
+// 0 until the thread draws its first interval
+extern __thread int64_t sProfBytesLeft LFMALLOC_TLS_INIT_EXEC;
+// mean bytes between samples, 0 if sampling is disabled
+extern size_t sProfRate;
+// number of live samples by hash of their ptr
+extern std::atomic<uint32_t>* sProfFilter;
+
+inline size_t ProfFilterIdx(char* ptr)
+{
+    return ((uint64_t)ptr * 0x9E3779B97F4A7C15ULL) >> (64 - LG_PROF_FILTER_SIZE);
+}
+
+// false if `ptr` is known not to be sampled, so that frees can skip the
+//  sample table, whose misses probe past tombstones
+// sampling must be enabled
+inline bool ProfMaybeSampled(char* ptr)
+{
+    return sProfFilter[ProfFilterIdx(ptr)].load(std::memory_order_relaxed) != 0;
+}
+
+// reads LFMALLOC_PROF_RATE and LFMALLOC_PROF_SIGNAL
+void InitProf();
+// draws bytes until the next sample of the calling thread
+// returns false if sampling is disabled
+bool ProfNextSample();
+// serve a sampled allocation from its size class and record it,
+//  defined in lrmalloc.cpp
+void* ProfAlloc(size_t size, bool zero);
+// record a sampled allocation, with the stack trace of the caller
+void ProfRecord(char* ptr, size_t size);
+// forget a sampled allocation, if `ptr` is one
+// returns false if `ptr` isn't sampled
+bool ProfRemove(char* ptr);
+// sampled allocation moved to `newPtr`, with a new size
+void ProfMove(char* ptr, char* newPtr, size_t size);
+
+#endif // __PROF_H_
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#include "remote.h"
+
+#include <algorithm>
+
+#include "lrmalloc_internal.h"
+#include "pages.h"
+
+__thread RemoteInbox* sRemoteInbox = nullptr;
+// blocks waiting to be handed to their owner, one batch per size class
+static __thread RemoteBatch sRemoteBatch[MAX_SZ_IDX] LFMALLOC_TLS_INIT_EXEC;
+// set once RemoteFinalize ran, blocks freed afterwards (e.g by later
+//  thread local destructors) can't be batched, nothing flushes them
+static __thread bool sRemoteFinalized LFMALLOC_TLS_INIT_EXEC = false;
+// inboxes of exited threads, page aligned, aba counter in low bits
+static std::atomic<uint64_t> sFreeInboxes({ 0 });
+
+STATIC_ASSERT(sizeof(RemoteInbox) <= PAGE, "Inbox must fit in a page");
+
+// return a list of blocks to their superblocks
+static void ReturnBlocks(size_t scIdx, char* block, uint32_t count)
+{
+    uint32_t const blockSize = SizeClasses[scIdx].blockSize;
+    BlockGroups groups(scIdx);
+    for (uint32_t idx = 0; idx < count; ++idx) {
+        // adding block overwrites its link
+        char* next = block + *(ptrdiff_t*)block + blockSize;
+        groups.Add(block);
+        block = next;
+    }
+
+    groups.Flush();
+}
+
+static void RemoteFlush(size_t scIdx)
+{
+    RemoteBatch* batch = &sRemoteBatch[scIdx];
+    if (batch->count == 0) {
+        return;
+    }
+
+    if (!batch->owner->Push(scIdx, batch->head, batch->tail, batch->count)) {
+        ReturnBlocks(scIdx, batch->head, batch->count);
+    }
+
+    batch->count = 0;
+}
+
+bool RemoteInbox::Push(size_t scIdx, char* head, char* tail, uint32_t count)
+{
+    SizeClassData* sc = &SizeClasses[scIdx];
+    uint32_t const blockSize = sc->blockSize;
+    // bound blocks stranded in an owner that stopped allocating
+    uint64_t const maxCount = std::min<uint64_t>(2 * sc->blockNum, (1ULL << (64 - REMOTE_COUNT_SHIFT)) - 1);
+
+    uint64_t oldHead = _heads[scIdx].load();
+    uint64_t newHead;
+    do {
+        if (oldHead == REMOTE_CLOSED) {
+            return false;
+        }
+
+        uint64_t oldCount = oldHead >> REMOTE_COUNT_SHIFT;
+        if (oldCount + count > maxCount) {
+            return false;
+        }
+
+        // only drained as a whole, no aba problem
+        char* oldBlock = (char*)(oldHead & REMOTE_PTR_MASK);
+        *(ptrdiff_t*)tail = oldBlock - tail - blockSize;
+        newHead = (uint64_t)head | ((oldCount + count) << REMOTE_COUNT_SHIFT);
+    } while (!_heads[scIdx].compare_exchange_weak(oldHead, newHead));
+
+    return true;
+}
+
+char* RemoteInbox::Drain(size_t scIdx, uint32_t& count)
+{
+    // skip exchange if there's nothing to take
+    uint64_t head = _heads[scIdx].load(std::memory_order_relaxed);
+    if (head == 0) {
+        count = 0;
+        return nullptr;
+    }
+
+    head = _heads[scIdx].exchange(0);
+    ASSERT(head != REMOTE_CLOSED);
+    count = head >> REMOTE_COUNT_SHIFT;
+    return (char*)(head & REMOTE_PTR_MASK);
+}
+
+void RemoteInbox::Close()
+{
+    for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
+        uint64_t head = _heads[scIdx].exchange(REMOTE_CLOSED);
+        ASSERT(head != REMOTE_CLOSED);
+        ReturnBlocks(scIdx, (char*)(head & REMOTE_PTR_MASK), head >> REMOTE_COUNT_SHIFT);
+    }
+}
+
+void RemoteInbox::Open()
+{
+    for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
+        _heads[scIdx].store(0);
+    }
+}
+
+RemoteInbox* GetRemoteInbox()
+{
+    if (LIKELY(sRemoteInbox != nullptr)) {
+        return sRemoteInbox;
+    }
+
+    // an inbox taken now would never be closed
+    if (UNLIKELY(sRemoteFinalized)) {
+        return nullptr;
+    }
+
+    // reuse inbox of an exited thread
+    uint64_t oldHead = sFreeInboxes.load();
+    uint64_t newHead;
+    RemoteInbox* inbox;
+    do {
+        inbox = (RemoteInbox*)(oldHead & ~PAGE_MASK);
+        if (!inbox) {
+            break;
+        }
+
+        // inboxes are never unmapped, safe to read even if stale
+        newHead = (inbox->next.load() & ~PAGE_MASK) | (oldHead & PAGE_MASK);
+    } while (!sFreeInboxes.compare_exchange_weak(oldHead, newHead));
+
+    if (!inbox) {
+        // zero-filled, all heads are open and empty
+        inbox = (RemoteInbox*)PageAlloc(PAGE);
+        if (UNLIKELY(inbox == nullptr)) {
+            return nullptr;
+        }
+    } else {
+        inbox->Open();
+    }
+
+    sRemoteInbox = inbox;
+    return inbox;
+}
+
+void RemoteFree(size_t scIdx, RemoteInbox* owner, char* block)
+{
+    if (UNLIKELY(sRemoteFinalized)) {
+        ReturnBlocks(scIdx, block, 1);
+        return;
+    }
+
+    RemoteBatch* batch = &sRemoteBatch[scIdx];
+    if (batch->count > 0 && batch->owner != owner) {
+        RemoteFlush(scIdx);
+    }
+
+    if (batch->count == 0) {
+        batch->owner = owner;
+        batch->tail = block;
+    } else {
+        size_t blockSize = SizeClasses[scIdx].blockSize;
+        *(ptrdiff_t*)block = batch->head - block - blockSize;
+    }
+
+    batch->head = block;
+    if (++batch->count == REMOTE_BATCH) {
+        RemoteFlush(scIdx);
+    }
+}
+
+void RemoteFinalize()
+{
+    for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
+        RemoteFlush(scIdx);
+    }
+
+    sRemoteFinalized = true;
+    RemoteInbox* inbox = sRemoteInbox;
+    if (inbox == nullptr) {
+        return;
+    }
+
+    sRemoteInbox = nullptr;
+    inbox->Close();
+
+    uint64_t oldHead = sFreeInboxes.load();
+    uint64_t newHead;
+    do {
+        inbox->next.store(oldHead);
+        newHead = (uint64_t)inbox | ((oldHead + 1) & PAGE_MASK);
+    } while (!sFreeInboxes.compare_exchange_weak(oldHead, newHead));
+}
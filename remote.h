@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#ifndef __REMOTE_H_
+#define __REMOTE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "log.h"
+#include "lrmalloc.h"
+#include "size_classes.h"
+
+// if 1, blocks freed by a thread other than the one that took them from
+//  their superblock are handed back to that (owner) thread in batches,
+//  instead of mixing in the freeing thread's cache
+// the owner reuses them in bulk on its next cache fill
+#ifndef LFMALLOC_REMOTE_FREE
+#define LFMALLOC_REMOTE_FREE 0
+#endif
+
+// number of blocks batched per size class before they're handed to
+//  their owner
+#define REMOTE_BATCH 32
+// inbox heads hold the number of blocks in their top bits
+#define REMOTE_COUNT_SHIFT 48
+#define REMOTE_PTR_MASK ((1ULL << REMOTE_COUNT_SHIFT) - 1)
+// head of the inbox of an exited thread
+#define REMOTE_CLOSED 1ULL
+
+// blocks freed by other threads into superblocks the thread owns
+// each size class is a stack of block batches, pushed by any thread and
+//  drained at once by the owner
+// inboxes are never unmapped, as freeing threads can hold stale owners,
+//  inboxes of exited threads are reused by new threads
+struct RemoteInbox {
+private:
+    // head block, number of blocks in the top bits
+    // REMOTE_CLOSED if owner exited
+    std::atomic<uint64_t> _heads[MAX_SZ_IDX];
+
+public:
+    // next inbox in list of unused inboxes, aba counter in low bits
+    std::atomic<uint64_t> next;
+
+public:
+    // add list of `count` blocks from `head` to `tail`
+    // returns false if the owner exited or has too many blocks waiting,
+    //  in which case the caller keeps the blocks
+    bool Push(size_t scIdx, char* head, char* tail, uint32_t count);
+    // take all waiting blocks of a size class, linked like cache bin
+    //  blocks, `count` is set to the number of blocks
+    char* Drain(size_t scIdx, uint32_t& count);
+    // reject further pushes, waiting blocks go back to their superblocks
+    void Close();
+    // accept pushes again, for a reused inbox
+    void Open();
+};
+
+// blocks freed by the thread that have the same owner
+struct RemoteBatch {
+    RemoteInbox* owner;
+    char* head;
+    char* tail;
+    uint32_t count;
+};
+
+// inbox of the calling thread, nullptr until the thread fills a cache
+extern __thread RemoteInbox* sRemoteInbox LFMALLOC_TLS_INIT_EXEC;
+
+// returns inbox of the calling thread, allocated on first use
+// returns nullptr if out of memory or after RemoteFinalize, blocks of
+//  the thread's superblocks then have no owner
+RemoteInbox* GetRemoteInbox();
+// batch a block owned by another thread, handing the batch to `owner`
+//  once full or once a block of another owner is freed
+void RemoteFree(size_t scIdx, RemoteInbox* owner, char* block);
+// used for thread termination, hands all batches to their owners and
+//  releases the thread's inbox
+// blocks of other threads freed afterwards go back to their superblocks
+void RemoteFinalize();
+
+#endif // __REMOTE_H_
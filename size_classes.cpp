@@ -17,15 +17,22 @@
 
 SizeClassData SizeClasses[MAX_SZ_IDX] = { { 0, 0 }, SIZE_CLASSES };
 
-size_t SizeClassLookup[MAX_SZ + 1] = { 0 };
+size_t SizeClassLookup[MAX_LOOKUP_SZ + 1] = { 0 };
 
 void InitSizeClass()
 {
-    // fill blockNum and cacheBlockNum
+    // fill sbSize, blockNum and cacheBlockNum
     for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
         SizeClassData& sc = SizeClasses[scIdx];
+        // sbSize calc
+        sc.sbSize = SB_SIZE;
+        while (sc.sbSize / sc.blockSize < SB_MIN_BLOCK_NUM) {
+            sc.sbSize *= 2;
+        }
+
+        ASSERT(sc.sbSize <= MAX_SB_SIZE);
         // blockNum calc
-        sc.blockNum = SB_SIZE / sc.blockSize;
+        sc.blockNum = sc.sbSize / sc.blockSize;
         // cacheBlockNum calc
         sc.cacheBlockNum = sc.blockNum * 1;
         ASSERT(sc.blockNum > 0);
@@ -38,9 +45,12 @@ void InitSizeClass()
     for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
         SizeClassData const& sc = SizeClasses[scIdx];
         size_t blockSize = sc.blockSize;
-        while (lookupIdx <= blockSize) {
+        while (lookupIdx <= blockSize && lookupIdx <= MAX_LOOKUP_SZ) {
             SizeClassLookup[lookupIdx] = scIdx;
             ++lookupIdx;
         }
     }
+
+    // MAX_SZ must be the size of a size class
+    ASSERT(SizeClasses[GetSizeClass(MAX_SZ)].blockSize == MAX_SZ);
 }
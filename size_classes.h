@@ -14,22 +14,35 @@
 
 // number of size classes
 // idx 0 reserved for large size classes
-#define MAX_SZ_IDX 40
+#define MAX_SZ_IDX 57
 #define LG_MAX_SIZE_IDX 6
 // last size covered by a size class
 // allocations with size > MAX_SZ are not covered by a size class
-#define MAX_SZ ((1 << 13) + (1 << 11) * 3)
-#define SB_SIZE 1024 * 256
+// can be lowered to any binned size class, e.g ((1 << 13) + (1 << 11) * 3)
+#ifndef MAX_SZ
+#define MAX_SZ (1 << 18)
+#endif
+// last size resolved through SizeClassLookup, larger sizes are computed
+#define MAX_LOOKUP_SZ (MAX_SZ < 14336 ? MAX_SZ : 14336)
+#define LG_SB_SIZE 18
+#define SB_SIZE (1 << LG_SB_SIZE)
+// minimum number of blocks per superblock
+// size classes too large for SB_SIZE use a power of two multiple of it
+#define SB_MIN_BLOCK_NUM 8
+#define MAX_SB_SIZE (SB_SIZE * 8)
 
 // contains size classes
 struct SizeClassData {
 public:
     // size of block
     uint32_t blockSize;
-    // cached number of blocks, equal to SB_SIZE / blockSize
+    // cached number of blocks, equal to sbSize / blockSize
     uint32_t blockNum;
-    // number of blocks held by thread-specific caches
+    // max number of blocks held by thread-specific caches
+    // actual limit adapts to usage, see TCacheBin
     uint32_t cacheBlockNum;
+    // superblock size
+    uint32_t sbSize;
 
 public:
     size_t GetBlockNum() const { return blockNum; }
@@ -39,14 +52,23 @@ public:
 // initialized at compile time
 extern SizeClassData SizeClasses[MAX_SZ_IDX];
 // *not* initialized at compile time, needs InitSizeClass() call
-extern size_t SizeClassLookup[MAX_SZ + 1];
+extern size_t SizeClassLookup[MAX_LOOKUP_SZ + 1];
 
 // must be called before GetSizeClass
 void InitSizeClass();
 
 inline size_t GetSizeClass(size_t size)
 {
-    return SizeClassLookup[size];
+    if (LIKELY(size <= MAX_LOOKUP_SZ)) {
+        return SizeClassLookup[size];
+    }
+
+    // size in ]2^lg, 2^(lg + 1)], which is split in 4 size classes
+    // same layout as SIZE_CLASSES, index = (lg - 4) * 4 + ndelta - 1
+    size_t lg = 63 - __builtin_clzl(size - 1);
+    size_t lgDelta = lg - 2;
+    size_t ndelta = (size - (1ULL << lg) + (1ULL << lgDelta) - 1) >> lgDelta;
+    return (lg - 4) * 4 + ndelta;
 }
 
 // size class data, from jemalloc 5.0
@@ -100,27 +122,27 @@ inline size_t GetSizeClass(size_t size)
     SC(36, 13, 11, 1, no, yes, 5, no)                                     \
     SC(37, 13, 11, 2, yes, yes, 6, no)                                    \
     SC(38, 13, 11, 3, no, yes, 7, no)                                     \
-    SC(39, 13, 11, 4, yes, no, 0, no)                                     \
-                                                                          \
-    SC(40, 14, 12, 1, yes, no, 0, no)                                     \
-    SC(41, 14, 12, 2, yes, no, 0, no)                                     \
-    SC(42, 14, 12, 3, yes, no, 0, no)                                     \
-    SC(43, 14, 12, 4, yes, no, 0, no)                                     \
-                                                                          \
-    SC(44, 15, 13, 1, yes, no, 0, no)                                     \
-    SC(45, 15, 13, 2, yes, no, 0, no)                                     \
-    SC(46, 15, 13, 3, yes, no, 0, no)                                     \
-    SC(47, 15, 13, 4, yes, no, 0, no)                                     \
-                                                                          \
-    SC(48, 16, 14, 1, yes, no, 0, no)                                     \
-    SC(49, 16, 14, 2, yes, no, 0, no)                                     \
-    SC(50, 16, 14, 3, yes, no, 0, no)                                     \
-    SC(51, 16, 14, 4, yes, no, 0, no)                                     \
-                                                                          \
-    SC(52, 17, 15, 1, yes, no, 0, no)                                     \
-    SC(53, 17, 15, 2, yes, no, 0, no)                                     \
-    SC(54, 17, 15, 3, yes, no, 0, no)                                     \
-    SC(55, 17, 15, 4, yes, no, 0, no)                                     \
+    SC(39, 13, 11, 4, yes, yes, 4, no)                                    \
+                                                                          \
+    SC(40, 14, 12, 1, yes, yes, 5, no)                                    \
+    SC(41, 14, 12, 2, yes, yes, 6, no)                                    \
+    SC(42, 14, 12, 3, yes, yes, 7, no)                                    \
+    SC(43, 14, 12, 4, yes, yes, 8, no)                                    \
+                                                                          \
+    SC(44, 15, 13, 1, yes, yes, 10, no)                                   \
+    SC(45, 15, 13, 2, yes, yes, 12, no)                                   \
+    SC(46, 15, 13, 3, yes, yes, 14, no)                                   \
+    SC(47, 15, 13, 4, yes, yes, 16, no)                                   \
+                                                                          \
+    SC(48, 16, 14, 1, yes, yes, 20, no)                                   \
+    SC(49, 16, 14, 2, yes, yes, 24, no)                                   \
+    SC(50, 16, 14, 3, yes, yes, 28, no)                                   \
+    SC(51, 16, 14, 4, yes, yes, 32, no)                                   \
+                                                                          \
+    SC(52, 17, 15, 1, yes, yes, 40, no)                                   \
+    SC(53, 17, 15, 2, yes, yes, 48, no)                                   \
+    SC(54, 17, 15, 3, yes, yes, 56, no)                                   \
+    SC(55, 17, 15, 4, yes, yes, 64, no)                                   \
                                                                           \
     SC(56, 18, 16, 1, yes, no, 0, no)                                     \
     SC(57, 18, 16, 2, yes, no, 0, no)                                     \
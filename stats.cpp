@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// for ENOENT, EINVAL, EPERM
+#include <errno.h>
+
+#include "pages.h"
+#include "tcache.h"
+
+ThreadStats sSharedStats;
+__thread ThreadStats* sThreadStats = &sSharedStats;
+// all records, including sSharedStats
+// records are only ever pushed, so the list can be walked without ABA
+static std::atomic<ThreadStats*> sAllStats({ &sSharedStats });
+
+void InitThreadStats()
+{
+    if (LIKELY(sThreadStats != &sSharedStats)) {
+        return;
+    }
+
+    // reuse record of an exited thread
+    for (ThreadStats* stats = sAllStats.load(); stats; stats = stats->next) {
+        bool used = false;
+        if (stats != &sSharedStats && !stats->used.load() && stats->used.compare_exchange_strong(used, true)) {
+            sThreadStats = stats;
+            return;
+        }
+    }
+
+    // zero-filled
+    ThreadStats* stats = (ThreadStats*)PageAlloc(PAGE_CEILING(sizeof(ThreadStats)));
+    if (stats == nullptr) {
+        return;
+    }
+
+    stats->used.store(true);
+    ThreadStats* head = sAllStats.load();
+    do {
+        stats->next = head;
+    } while (!sAllStats.compare_exchange_weak(head, stats));
+
+    sThreadStats = stats;
+}
+
+void FinalizeThreadStats()
+{
+    ThreadStats* stats = sThreadStats;
+    if (stats == &sSharedStats) {
+        return;
+    }
+
+    // destructors running after this still count, in the shared record
+    sThreadStats = &sSharedStats;
+    stats->used.store(false);
+}
+
+uint64_t SumStats(StatCounter ThreadStats::*stat)
+{
+    uint64_t sum = 0;
+    for (ThreadStats* stats = sAllStats.load(); stats; stats = stats->next) {
+        sum += (stats->*stat).Get();
+    }
+
+    return sum;
+}
+
+uint64_t SumBinStats(size_t scIdx, StatCounter BinStats::*stat)
+{
+    uint64_t sum = 0;
+    for (ThreadStats* stats = sAllStats.load(); stats; stats = stats->next) {
+        sum += (stats->bins[scIdx].*stat).Get();
+    }
+
+    return sum;
+}
+
+// returns value of a per size class name, `name` past "bins.<i>."
+static bool ReadBinStat(size_t scIdx, const char* name, uint64_t& val)
+{
+    if (!strcmp(name, "nmalloc")) {
+        val = SumBinStats(scIdx, &BinStats::mallocs);
+    } else if (!strcmp(name, "nfree")) {
+        val = SumBinStats(scIdx, &BinStats::frees);
+    } else if (!strcmp(name, "nfills")) {
+        val = SumBinStats(scIdx, &BinStats::fills);
+    } else if (!strcmp(name, "nflushes")) {
+        val = SumBinStats(scIdx, &BinStats::flushes);
+    } else if (!strcmp(name, "partial")) {
+        // pops are counted after the matching push
+        val = SumBinStats(scIdx, &BinStats::partialPushes);
+        val -= std::min(val, SumBinStats(scIdx, &BinStats::partialPops));
+    } else if (!strcmp(name, "superblocks")) {
+        val = SumBinStats(scIdx, &BinStats::sbAllocs);
+        val -= std::min(val, SumBinStats(scIdx, &BinStats::sbFrees));
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// parses "<i>." at the start of `name`, returns what follows
+static const char* ParseBinIdx(const char* name, size_t& scIdx)
+{
+    char* end;
+    scIdx = strtoul(name, &end, 10);
+    if (end == name || *end != '.' || scIdx >= MAX_SZ_IDX) {
+        return nullptr;
+    }
+
+    return end + 1;
+}
+
+static bool ReadStat(const char* name, uint64_t& val)
+{
+    size_t scIdx;
+    const char* field;
+    if (!strcmp(name, "bins.count")) {
+        val = MAX_SZ_IDX;
+    } else if (!strncmp(name, "bins.", 5) && (field = ParseBinIdx(name + 5, scIdx)) && !strcmp(field, "size")) {
+        val = SizeClasses[scIdx].blockSize;
+    } else if (!strcmp(name, "thread.tcache.cached")) {
+        val = 0;
+        for (size_t idx = 1; idx < MAX_SZ_IDX; ++idx) {
+            val += (uint64_t)TCache[idx].GetBlockNum() * SizeClasses[idx].blockSize;
+        }
+    } else if (!strcmp(name, "stats.enabled")) {
+        val = LFMALLOC_STATS;
+    } else if (!strcmp(name, "stats.descriptors.active")) {
+        size_t active, resident;
+        lf_malloc_desc_stats(&active, &resident);
+        val = active;
+    } else if (!strcmp(name, "stats.descriptors.resident")) {
+        size_t active, resident;
+        lf_malloc_desc_stats(&active, &resident);
+        val = resident;
+    } else if (!LFMALLOC_STATS) {
+        return false;
+    } else if (!strcmp(name, "stats.small.allocated")) {
+        val = 0;
+        for (size_t idx = 1; idx < MAX_SZ_IDX; ++idx) {
+            uint64_t mallocs = SumBinStats(idx, &BinStats::mallocs);
+            uint64_t frees = SumBinStats(idx, &BinStats::frees);
+            val += (mallocs - std::min(mallocs, frees)) * SizeClasses[idx].blockSize;
+        }
+    } else if (!strcmp(name, "stats.large.allocated")) {
+        val = SumStats(&ThreadStats::largeAllocBytes);
+        val -= std::min(val, SumStats(&ThreadStats::largeFreeBytes));
+    } else if (!strcmp(name, "stats.large.nmalloc")) {
+        val = SumStats(&ThreadStats::largeAllocs);
+    } else if (!strcmp(name, "stats.large.nfree")) {
+        val = SumStats(&ThreadStats::largeFrees);
+    } else if (!strcmp(name, "stats.superblocks.mapped")) {
+        val = SumStats(&ThreadStats::sbMapBytes);
+    } else if (!strcmp(name, "stats.superblocks.unmapped")) {
+        val = SumStats(&ThreadStats::sbUnmapBytes);
+    } else if (!strcmp(name, "stats.superblocks.purged")) {
+        val = SumStats(&ThreadStats::sbPurgeBytes);
+    } else if (!strncmp(name, "stats.bins.", 11) && (field = ParseBinIdx(name + 11, scIdx))) {
+        return ReadBinStat(scIdx, field, val);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+extern "C" int lf_mallctl(const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen) noexcept
+{
+    LOG_DEBUG("name: %s", name);
+    if (newp != nullptr) {
+        return EPERM;
+    }
+
+    if (oldlenp == nullptr || *oldlenp != sizeof(uint64_t) || oldp == nullptr) {
+        return EINVAL;
+    }
+
+    uint64_t val;
+    if (!ReadStat(name, val)) {
+        return ENOENT;
+    }
+
+    *(uint64_t*)oldp = val;
+    return 0;
+}
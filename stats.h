@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 Ricardo Leite. All rights reserved.
+ * Licenced under the MIT licence. See COPYING file in the project root for
+ * details.
+ */
+
+#ifndef __STATS_H_
+#define __STATS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "log.h"
+#include "lrmalloc.h"
+#include "size_classes.h"
+
+// if 1, allocator events are counted per thread and reported through
+//  lf_mallctl, see lrmalloc.h
+// counters are plain loads and stores to thread-owned memory, no atomic
+//  read-modify-write on any path
+#ifndef LFMALLOC_STATS
+#define LFMALLOC_STATS 0
+#endif
+
+// counter written by a single thread, read by any
+struct StatCounter {
+private:
+    std::atomic<uint64_t> _val;
+
+public:
+    void Add(uint64_t n)
+    {
+        _val.store(_val.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t Get() const { return _val.load(std::memory_order_relaxed); }
+};
+
+// counters of a size class
+struct BinStats {
+    StatCounter mallocs;
+    StatCounter frees;
+    // cache fills and flushes
+    StatCounter fills;
+    StatCounter flushes;
+    // superblocks pushed to and popped from partial lists
+    StatCounter partialPushes;
+    StatCounter partialPops;
+    // superblocks carved and released once empty
+    StatCounter sbAllocs;
+    StatCounter sbFrees;
+};
+
+// counters of a thread
+// records are never freed, records of exited threads are reused by new
+//  threads so that counts stay cumulative
+struct ThreadStats {
+    BinStats bins[MAX_SZ_IDX];
+    StatCounter largeAllocs;
+    StatCounter largeFrees;
+    // large allocation bytes, including page rounding
+    StatCounter largeAllocBytes;
+    StatCounter largeFreeBytes;
+    // superblock bytes mapped from and unmapped to the OS
+    StatCounter sbMapBytes;
+    StatCounter sbUnmapBytes;
+    // superblock bytes whose pages were purged
+    StatCounter sbPurgeBytes;
+
+    // next record in list of all records
+    ThreadStats* next;
+    // record belongs to a running thread
+    std::atomic<bool> used;
+};
+
+// record of the calling thread
+// threads that haven't taken a record yet share sSharedStats, whose
+//  counts may be lost under concurrent updates
+extern __thread ThreadStats* sThreadStats LFMALLOC_TLS_INIT_EXEC;
+extern ThreadStats sSharedStats;
+
+#if LFMALLOC_STATS
+#define STATS_ADD(stat, n) sThreadStats->stat.Add(n)
+#else
+#define STATS_ADD(stat, n)
+#endif
+
+// takes a record for the calling thread if it doesn't have one yet
+// meant for slow paths
+void InitThreadStats();
+// used for thread termination, record is kept for reuse
+void FinalizeThreadStats();
+// sum of a counter over all records
+uint64_t SumStats(StatCounter ThreadStats::*stat);
+uint64_t SumBinStats(size_t scIdx, StatCounter BinStats::*stat);
+
+#endif // __STATS_H_
@@ -9,3 +9,99 @@
 // thread cache, uses tsd/tls
 // one cache per thread
 __thread TCacheBin TCache[MAX_SZ_IDX];
+// bytes that limits of all bins of the thread add up to
+static __thread size_t sCacheBytes LFMALLOC_TLS_INIT_EXEC = 0;
+// fills and flushes since last idle pass
+static __thread uint32_t sCacheEvents LFMALLOC_TLS_INIT_EXEC = 0;
+
+// limit a bin starts with, also the smallest limit it shrinks to
+static uint32_t GetStartLimit(size_t scIdx)
+{
+    SizeClassData* sc = &SizeClasses[scIdx];
+    size_t limit = TCACHE_START_SZ / sc->blockSize;
+    limit = std::min<size_t>(limit, sc->cacheBlockNum);
+    return std::max<size_t>(limit, 1);
+}
+
+// count a fill or flush, idle bins are checked every TCACHE_GC_EVENTS
+static void CountEvent()
+{
+    if (UNLIKELY(++sCacheEvents >= TCACHE_GC_EVENTS)) {
+        CollectCache();
+    }
+}
+
+void TCacheBin::SetLimit(size_t scIdx, uint32_t limit)
+{
+    size_t blockSize = SizeClasses[scIdx].blockSize;
+    sCacheBytes -= _limit * blockSize;
+    sCacheBytes += limit * blockSize;
+    _limit = limit;
+}
+
+void TCacheBin::Grow(size_t scIdx)
+{
+    SizeClassData* sc = &SizeClasses[scIdx];
+    size_t blockSize = sc->blockSize;
+
+    _flushNum = 0;
+    _useNum++;
+
+    // first use starts small, then double on each fill
+    size_t limit = (_limit == 0) ? GetStartLimit(scIdx) : _limit * 2;
+    limit = std::min<size_t>(limit, sc->cacheBlockNum);
+
+    // can only grow into the remaining budget, but never below
+    //  the current limit or a single block
+    size_t used = std::min<size_t>(sCacheBytes - _limit * blockSize, LFMALLOC_TCACHE_BUDGET);
+    limit = std::min<size_t>(limit, (LFMALLOC_TCACHE_BUDGET - used) / blockSize);
+    limit = std::max<size_t>(limit, std::max<uint32_t>(_limit, 1));
+    SetLimit(scIdx, limit);
+
+    CountEvent();
+}
+
+void TCacheBin::Shrink(size_t scIdx)
+{
+    _useNum++;
+
+    uint32_t start = GetStartLimit(scIdx);
+    if (_limit == 0) {
+        // bin is first used by a free
+        SetLimit(scIdx, start);
+    } else if ((_flushNum += GetFlushNum()) >= TCACHE_SHRINK_FLUSHES * _limit) {
+        // mostly freeing, fills are rare
+        _flushNum = 0;
+        if (_limit > start) {
+            SetLimit(scIdx, std::max(_limit / 2, start));
+        }
+    }
+
+    CountEvent();
+}
+
+bool TCacheBin::Collect(size_t scIdx)
+{
+    bool idle = (_useNum == 0);
+    _useNum = 0;
+
+    uint32_t start = GetStartLimit(scIdx);
+    if (idle && _limit > start) {
+        SetLimit(scIdx, std::max(_limit / 2, start));
+    }
+
+    return idle;
+}
+
+void CollectCache()
+{
+    sCacheEvents = 0;
+
+    for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
+        TCacheBin* cache = &TCache[scIdx];
+        // blocks of idle bins are better off in their superblocks
+        if (cache->Collect(scIdx) && cache->GetBlockNum() > 0) {
+            FlushCache(scIdx, cache, cache->GetBlockNum());
+        }
+    }
+}
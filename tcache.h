@@ -10,18 +10,54 @@
 #include "log.h"
 #include "lrmalloc.h"
 #include "size_classes.h"
+#include <algorithm>
 #include <cstddef>
 
+// max number of bytes all bins of a thread can hold
+// bin limits only grow while their sum fits in the budget
+#ifndef LFMALLOC_TCACHE_BUDGET
+#define LFMALLOC_TCACHE_BUDGET (1ULL << 22)
+#endif
+// initial bin limit, in bytes, at least 1 block
+#define TCACHE_START_SZ (1ULL << 14)
+// full bins worth of blocks flushed without a fill before a bin limit
+//  is halved
+#define TCACHE_SHRINK_FLUSHES 2
+// fills and flushes of a thread between passes over its idle bins
+#define TCACHE_GC_EVENTS 256
+// percentage of blocks of a full bin that are flushed, from the top
+// flushing only part of the bin avoids refilling it right away
+#ifndef LFMALLOC_TCACHE_FLUSH_PCT
+#define LFMALLOC_TCACHE_FLUSH_PCT 50
+#endif
+
 struct TCacheBin {
 private:
     char* _block = nullptr;
     uint32_t _blockNum = 0;
+    // the bottom min(_freshNum, _blockNum) blocks of the list were never
+    //  handed out and come from zero-filled pages
+    uint32_t _freshNum = 0;
+    // max number of blocks held, 0 until the bin is first used
+    uint32_t _limit = 0;
+    // blocks flushed since last fill
+    uint32_t _flushNum = 0;
+    // fills and flushes since last idle pass
+    uint32_t _useNum = 0;
 
 public:
+    TCacheBin() = default;
+    // standalone bin, used to move a batch of at most `limit` blocks
+    explicit TCacheBin(uint32_t limit)
+        : _limit(limit)
+    {
+    }
+
     // common, fast ops
     void PushBlock(char* block, size_t scIdx);
     // push block list, cache *must* be empty
-    void PushList(char* block, uint32_t length);
+    // `zeroed` if the blocks are known to be zero-filled
+    void PushList(char* block, uint32_t length, bool zeroed);
 
     char* PopBlock(size_t scIdx); // can return nullptr
     // manually popped list of blocks and now need to update cache
@@ -30,8 +66,22 @@ public:
     char* PeekBlock() const { return _block; }
 
     uint32_t GetBlockNum() const { return _blockNum; }
+    // whether next PopBlock returns a zero-filled block
+    bool IsZeroed() const { return _blockNum <= _freshNum; }
+    uint32_t GetLimit() const { return _limit; }
+    // number of blocks to flush from a full bin, so that there's room for
+    //  at least one more block
+    uint32_t GetFlushNum() const;
 
     // slow operations like fill/flush handled in cache user
+    // limit adaptation, see tcache.cpp
+    void Grow(size_t scIdx);
+    void Shrink(size_t scIdx);
+    // returns true if bin was not filled or flushed since last call
+    bool Collect(size_t scIdx);
+
+private:
+    void SetLimit(size_t scIdx, uint32_t limit);
 };
 
 inline void TCacheBin::PushBlock(char* block, size_t scIdx)
@@ -40,10 +90,12 @@ inline void TCacheBin::PushBlock(char* block, size_t scIdx)
     // block has at least sizeof(char*)
     *(ptrdiff_t*)block = _block - block - blockSize;
     _block = block;
+    // pushed block sits on top of the fresh ones
+    _freshNum = std::min(_freshNum, _blockNum);
     _blockNum++;
 }
 
-inline void TCacheBin::PushList(char* block, uint32_t length)
+inline void TCacheBin::PushList(char* block, uint32_t length, bool zeroed)
 {
     // caller must ensure there's no available block
     // this op is only used to fill empty cache
@@ -51,6 +103,7 @@ inline void TCacheBin::PushList(char* block, uint32_t length)
 
     _block = block;
     _blockNum = length;
+    _freshNum = zeroed ? length : 0;
 }
 
 inline char* TCacheBin::PopBlock(size_t scIdx)
@@ -72,10 +125,24 @@ inline void TCacheBin::PopList(char* block, uint32_t length)
     _blockNum -= length;
 }
 
+inline uint32_t TCacheBin::GetFlushNum() const
+{
+    uint32_t blockNum = _blockNum * LFMALLOC_TCACHE_FLUSH_PCT / 100;
+    if (_blockNum >= _limit) {
+        blockNum = std::max(blockNum, _blockNum - _limit + 1);
+    }
+
+    return std::min(blockNum, _blockNum);
+}
+
 // use tls init exec model
 extern __thread TCacheBin TCache[MAX_SZ_IDX] LFMALLOC_TLS_INIT_EXEC LFMALLOC_CACHE_ALIGNED;
 
-void FillCache(size_t scIdx, TCacheBin* cache);
-void FlushCache(size_t scIdx, TCacheBin* cache);
+// returns false if out of memory, cache is left empty
+bool FillCache(size_t scIdx, TCacheBin* cache);
+// flush the top `blockNum` blocks of the cache
+void FlushCache(size_t scIdx, TCacheBin* cache, uint32_t blockNum);
+// flush bins of the calling thread that went idle
+void CollectCache();
 
 #endif // __TCACHE_H_
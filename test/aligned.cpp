@@ -0,0 +1,43 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <malloc.h>
+
+int main()
+{
+    printf("Aligned alloc tests\n");
+
+    constexpr size_t numAllocs = 64;
+    void* allocs[numAllocs];
+
+    // small class sizes are served from superblocks when the block size
+    //  is a multiple of the alignment, large ones from mappings
+    for (size_t alignment = 8; alignment <= (1 << 20); alignment <<= 1) {
+        for (size_t size = 1; size < (1 << 20); size = size * 3 + 1) {
+            for (auto& alloc : allocs) {
+                alloc = aligned_alloc(alignment, size);
+                if (alloc == nullptr || ((uintptr_t)alloc & (alignment - 1))) {
+                    printf("aligned_alloc(%zu, %zu) returned %p\n",
+                        alignment, size, alloc);
+                    return 1;
+                }
+
+                if (malloc_usable_size(alloc) < size) {
+                    printf("usable size %zu < %zu\n",
+                        malloc_usable_size(alloc), size);
+                    return 1;
+                }
+
+                memset(alloc, 0xAB, size);
+            }
+
+            for (auto& alloc : allocs) {
+                free(alloc);
+            }
+        }
+    }
+
+    return 0;
+}
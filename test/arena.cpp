@@ -0,0 +1,212 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "../lrmalloc.h"
+
+// resident set size, in pages
+static size_t GetRss()
+{
+    size_t size = 0, rss = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file) {
+        if (fscanf(file, "%zu %zu", &size, &rss) != 2) {
+            rss = 0;
+        }
+
+        fclose(file);
+    }
+
+    return rss;
+}
+
+// fill an arena with blocks of mixed sizes, check they're distinct and
+//  usable
+static bool FillArena(lf_arena_t* arena, size_t n, uint8_t pattern)
+{
+    size_t sizes[] = { 1, 8, 24, 100, 1000, 4096, 20000, 200000 };
+    std::vector<char*> ptrs;
+    std::vector<size_t> lens;
+    for (size_t idx = 0; idx < n; ++idx) {
+        size_t size = sizes[idx % 8];
+        if (size > 4096 && idx % 64 >= 8) {
+            size = 48;
+        }
+
+        char* ptr = (char*)lf_arena_malloc(arena, size);
+        if (ptr == nullptr) {
+            printf("arena malloc of %zu bytes failed\n", size);
+            return false;
+        }
+
+        memset(ptr, pattern, size);
+        ptrs.push_back(ptr);
+        lens.push_back(size);
+    }
+
+    for (size_t idx = 0; idx < n; ++idx) {
+        if ((uint8_t)ptrs[idx][0] != pattern || (uint8_t)ptrs[idx][lens[idx] - 1] != pattern) {
+            printf("arena block %p overwritten\n", ptrs[idx]);
+            return false;
+        }
+    }
+
+    std::sort(ptrs.begin(), ptrs.end());
+    if (std::adjacent_find(ptrs.begin(), ptrs.end()) != ptrs.end()) {
+        printf("duplicate arena block\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    printf("Arena tests\n");
+
+    // create, fill and destroy, arenas are reused
+    size_t rss = 0;
+    for (size_t round = 0; round < 50; ++round) {
+        lf_arena_t* arena = lf_arena_create();
+        if (arena == nullptr) {
+            printf("arena create failed\n");
+            return 1;
+        }
+
+        if (!FillArena(arena, 20000, (uint8_t)round)) {
+            return 1;
+        }
+
+        lf_arena_destroy(arena);
+        // memory of destroyed arenas is reused, rss doesn't keep growing
+        if (round == 5) {
+            rss = GetRss();
+        } else if (round > 5 && GetRss() > rss * 2 + 1024) {
+            printf("rss grew from %zu to %zu pages\n", rss, GetRss());
+            return 1;
+        }
+    }
+
+    // several arenas in use at once, destroyed in any order
+    {
+        lf_arena_t* arenas[8];
+        for (lf_arena_t*& arena : arenas) {
+            arena = lf_arena_create();
+            if (!FillArena(arena, 2000, 0x11)) {
+                return 1;
+            }
+        }
+
+        for (size_t idx = 0; idx < 8; idx += 2) {
+            lf_arena_destroy(arenas[idx]);
+        }
+
+        for (size_t idx = 1; idx < 8; idx += 2) {
+            if (!FillArena(arenas[idx], 2000, 0x22)) {
+                return 1;
+            }
+
+            lf_arena_destroy(arenas[idx]);
+        }
+    }
+
+    // shared by threads, destroyed once they're done
+    for (size_t round = 0; round < 10; ++round) {
+        lf_arena_t* arena = lf_arena_create();
+        bool ok = true;
+        std::vector<std::thread> threads;
+        for (size_t idx = 0; idx < 4; ++idx) {
+            threads.emplace_back([&, idx]() {
+                if (!FillArena(arena, 5000, (uint8_t)idx)) {
+                    ok = false;
+                }
+            });
+        }
+
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        if (!ok) {
+            return 1;
+        }
+
+        lf_arena_destroy(arena);
+    }
+
+    // destroyed while this thread still caches its blocks, then
+    //  the arena is reused
+    {
+        lf_arena_t* arena = lf_arena_create();
+        lf_arena_t* other = lf_arena_create();
+        std::thread([&]() {
+            lf_arena_malloc(arena, 64);
+            lf_arena_destroy(arena);
+            // stale cache is dropped, not flushed into the new arena
+            if (!FillArena(other, 1000, 0x33)) {
+                exit(1);
+            }
+        }).join();
+
+        lf_arena_t* reused = lf_arena_create();
+        if (!FillArena(reused, 1000, 0x44)) {
+            return 1;
+        }
+
+        lf_arena_destroy(reused);
+        lf_arena_destroy(other);
+    }
+
+    // thread default arena
+    {
+        // no bound arena, a regular block
+        void* ptr = lf_arena_malloc(nullptr, 64);
+        if (ptr == nullptr) {
+            printf("unbound arena malloc failed\n");
+            return 1;
+        }
+
+        free(ptr);
+
+        lf_arena_t* arena = lf_arena_create();
+        if (lf_arena_bind(arena) != nullptr) {
+            printf("unexpected bound arena\n");
+            return 1;
+        }
+
+        if (!FillArena(nullptr, 1000, 0x55)) {
+            return 1;
+        }
+
+        if (lf_arena_bind(nullptr) != arena) {
+            printf("bind didn't return previous arena\n");
+            return 1;
+        }
+
+        lf_arena_bind(arena);
+        lf_arena_destroy(arena);
+        if (lf_arena_bind(nullptr) != nullptr) {
+            printf("destroyed arena still bound\n");
+            return 1;
+        }
+    }
+
+    // regular allocations are unaffected
+    void* ptrs[1000];
+    for (void*& ptr : ptrs) {
+        ptr = malloc(64);
+        memset(ptr, 0x66, 64);
+    }
+
+    for (void* ptr : ptrs) {
+        free(ptr);
+    }
+
+    printf("Arena tests passed\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "../lrmalloc.h"
+
+// allocate a batch, check blocks are distinct and usable
+static bool CheckBatch(size_t size, size_t n, std::vector<void*>& ptrs)
+{
+    ptrs.assign(n, nullptr);
+    if (lf_malloc_batch(size, n, ptrs.data()) != n) {
+        printf("batch of %zu x %zu bytes failed\n", n, size);
+        return false;
+    }
+
+    for (void* ptr : ptrs) {
+        if (ptr == nullptr || malloc_usable_size(ptr) < size) {
+            printf("bad block in batch of %zu x %zu bytes\n", n, size);
+            return false;
+        }
+
+        memset(ptr, 0xA5, size);
+    }
+
+    std::vector<void*> sorted(ptrs);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        printf("duplicate block in batch of %zu x %zu bytes\n", n, size);
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    printf("Batch tests\n");
+
+    std::vector<void*> ptrs;
+    size_t sizes[] = { 0, 8, 24, 100, 1000, 4096, 20000, 200000 };
+    size_t counts[] = { 1, 7, 300, 5000, 100000 };
+    for (size_t size : sizes) {
+        for (size_t n : counts) {
+            if (size * n > (1ULL << 30)) {
+                continue;
+            }
+
+            if (!CheckBatch(size, n, ptrs)) {
+                return 1;
+            }
+
+            // interleave with regular allocations
+            void* extra = malloc(size);
+            free(extra);
+            lf_free_batch(ptrs.data(), n);
+        }
+    }
+
+    // mixed sizes, large blocks and nullptrs in one batch
+    std::vector<void*> mixed;
+    for (size_t idx = 0; idx < 10000; ++idx) {
+        mixed.push_back(idx % 97 == 0 ? nullptr : malloc(sizes[(idx / 100) % 8]));
+    }
+
+    lf_free_batch(mixed.data(), mixed.size());
+
+    // blocks freed by another thread
+    for (size_t round = 0; round < 20; ++round) {
+        if (!CheckBatch(64, 20000, ptrs)) {
+            return 1;
+        }
+
+        std::thread([&]() { lf_free_batch(ptrs.data(), ptrs.size()); }).join();
+    }
+
+    // everything must still work after the batches
+    if (!CheckBatch(64, 1000, ptrs)) {
+        return 1;
+    }
+
+    for (void* ptr : ptrs) {
+        free(ptr);
+    }
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <vector>
+
+int main()
+{
+    printf("Calloc tests\n");
+
+    // dirty blocks of every size, free them and make sure calloc
+    //  never hands them back without zeroing
+    constexpr size_t numAllocs = 64;
+    for (size_t size = 8; size <= (4 << 20); size += size / 3 + 8) {
+        std::vector<uint8_t*> allocs;
+        for (size_t i = 0; i < numAllocs; ++i) {
+            uint8_t* buffer = static_cast<uint8_t*>(malloc(size));
+            memset(buffer, 0xAB, size);
+            allocs.push_back(buffer);
+        }
+
+        for (size_t i = 0; i < numAllocs; ++i) {
+            // mix fresh and reused blocks
+            free(allocs[i]);
+            allocs[i] = static_cast<uint8_t*>(calloc(1, size));
+        }
+
+        for (size_t i = 0; i < numAllocs * 2; ++i) {
+            allocs.push_back(static_cast<uint8_t*>(calloc(size, 1)));
+        }
+
+        for (uint8_t* buffer : allocs) {
+            for (size_t k = 0; k < size; ++k) {
+                if (buffer[k] != 0) {
+                    printf("calloc block %p of size %zu not zeroed at offset %zu\n",
+                        buffer, size, k);
+                    return 1;
+                }
+            }
+
+            memset(buffer, 0xCD, size);
+            free(buffer);
+        }
+    }
+
+    return 0;
+}
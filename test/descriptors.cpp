@@ -0,0 +1,73 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+
+#include "../lrmalloc.h"
+
+int main()
+{
+    printf("Descriptor tests\n");
+
+    constexpr size_t numAllocs = 8192;
+    constexpr size_t size = 1 << 20;
+
+    // reserved up front, so that no other block is allocated during the
+    //  spike, which would keep its descriptor block active when sampled
+    //  (LFMALLOC_PROF)
+    std::vector<void*> allocs;
+    allocs.reserve(numAllocs);
+
+    size_t active;
+    size_t resident;
+    lf_malloc_desc_stats(&active, &resident);
+    size_t baseResident = resident;
+
+    // spike of large allocations, each with its own descriptor
+    // blocks are never touched, only descriptors use memory
+    // the large cache keeps a few of them once freed, the rest are
+    //  unmapped and their descriptors retired
+    for (size_t i = 0; i < numAllocs; ++i) {
+        void* ptr = malloc(size);
+        if (ptr == nullptr) {
+            break;
+        }
+
+        allocs.push_back(ptr);
+    }
+
+    lf_malloc_desc_stats(&active, &resident);
+    size_t peakResident = resident;
+    printf("%zu allocs, descriptors: %zu bytes active, %zu bytes resident\n",
+        allocs.size(), active, resident);
+    if (active < allocs.size() * 64) {
+        printf("active descriptor bytes %zu too low\n", active);
+        return 1;
+    }
+
+    for (void* ptr : allocs) {
+        free(ptr);
+    }
+
+    lf_malloc_desc_stats(&active, &resident);
+    printf("after free, descriptors: %zu bytes active, %zu bytes resident\n",
+        active, resident);
+
+    // most descriptor blocks must have been purged, including those
+    //  emptied by the last frees
+    if (resident - baseResident > (peakResident - baseResident) / 4) {
+        printf("descriptor memory not reclaimed\n");
+        return 1;
+    }
+
+    // purged descriptors must be reusable
+    for (size_t i = 0; i < allocs.size(); ++i) {
+        allocs[i] = malloc(size);
+    }
+
+    for (void* ptr : allocs) {
+        free(ptr);
+    }
+
+    return 0;
+}
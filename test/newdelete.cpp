@@ -0,0 +1,114 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../lrmalloc.h"
+
+static int sHandlerCalls = 0;
+
+static void Handler()
+{
+    // give up after first call, next failure throws
+    ++sHandlerCalls;
+    std::set_new_handler(nullptr);
+}
+
+static void ThrowingHandler()
+{
+    ++sHandlerCalls;
+    throw std::bad_alloc();
+}
+
+int main()
+{
+    printf("operator new/delete tests\n");
+
+    // sized delete returns the block to its size class
+    // sampled blocks are served differently, can't check reuse
+    bool sampling = getenv("LFMALLOC_PROF_RATE") != nullptr;
+    for (size_t size = 1; size <= 64 * 1024; size = size * 3 / 2 + 1) {
+        void* ptr = ::operator new(size);
+        ::operator delete(ptr, size);
+        void* again = ::operator new(size);
+        if (again != ptr && !sampling) {
+            printf("sized delete of %zu bytes didn't reuse block\n", size);
+            return 1;
+        }
+
+        ::operator delete(again);
+    }
+
+    // large blocks
+    void* large = ::operator new(4 << 20);
+    ::operator delete(large, 4 << 20);
+
+    // aligned, including alignments that force large blocks
+    for (size_t alignment = 16; alignment <= 8192; alignment *= 2) {
+        for (size_t size = 1; size <= 20000; size = size * 2 + 7) {
+            std::vector<void*> ptrs;
+            for (size_t i = 0; i < 64; ++i) {
+                void* ptr = ::operator new[](size, std::align_val_t(alignment));
+                if ((uintptr_t)ptr & (alignment - 1)) {
+                    printf("%zu bytes not aligned to %zu\n", size, alignment);
+                    return 1;
+                }
+
+                ((char*)ptr)[size - 1] = 1;
+                ptrs.push_back(ptr);
+            }
+
+            for (size_t i = 0; i < ptrs.size(); ++i) {
+                if (i % 2) {
+                    ::operator delete[](ptrs[i], size, std::align_val_t(alignment));
+                } else {
+                    ::operator delete[](ptrs[i], std::align_val_t(alignment));
+                }
+            }
+        }
+    }
+
+    // failed allocations
+    if (::operator new(SIZE_MAX / 2, std::nothrow) != nullptr) {
+        printf("nothrow new didn't fail\n");
+        return 1;
+    }
+
+    std::set_new_handler(Handler);
+    bool thrown = false;
+    try {
+        void* ptr = ::operator new(SIZE_MAX / 2);
+        ::operator delete(ptr);
+    } catch (std::bad_alloc const&) {
+        thrown = true;
+    }
+
+    if (!thrown || sHandlerCalls != 1) {
+        printf("new didn't call handler and throw\n");
+        return 1;
+    }
+
+    // nothrow new calls the handler too, and fails if it throws
+    sHandlerCalls = 0;
+    std::set_new_handler(ThrowingHandler);
+    if (::operator new(SIZE_MAX / 2, std::nothrow) != nullptr || sHandlerCalls != 1) {
+        printf("nothrow new didn't call handler and fail\n");
+        return 1;
+    }
+
+    std::set_new_handler(nullptr);
+
+    // containers and objects go through the sized overloads
+    std::vector<std::string> strings;
+    for (size_t i = 0; i < 100000; ++i) {
+        strings.emplace_back(i % 200, 'x');
+        if (i % 3 == 0) {
+            strings.pop_back();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "../lrmalloc.h"
+
+// bytes of address space the process can still map
+#define HEADROOM (256ULL << 20)
+
+static size_t VmSize()
+{
+    size_t size = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file) {
+        if (fscanf(file, "%zu", &size) != 1) {
+            size = 0;
+        }
+
+        fclose(file);
+    }
+
+    return size * 4096;
+}
+
+// allocate until out of memory, blocks must be usable until then
+static bool Exhaust(std::vector<void*>& ptrs, size_t size, size_t alignment, bool zero)
+{
+    for (size_t num = 0;; ++num) {
+        void* ptr;
+        if (alignment) {
+            ptr = aligned_alloc(alignment, size);
+        } else if (zero) {
+            ptr = calloc(1, size);
+        } else {
+            ptr = malloc(size);
+        }
+
+        if (ptr == nullptr) {
+            return true;
+        }
+
+        if (zero && ((char*)ptr)[size - 1] != 0) {
+            printf("calloc block %p not zero-filled\n", ptr);
+            return false;
+        }
+
+        memset(ptr, 0x5A, size);
+        ptrs.push_back(ptr);
+        if (num > (HEADROOM / size) * 4 + 1000) {
+            printf("allocations of %zu bytes never failed\n", size);
+            return false;
+        }
+    }
+}
+
+int main()
+{
+    printf("Out of memory tests\n");
+
+    // pagemap and other global structures are set up
+    free(malloc(1));
+
+    struct rlimit old;
+    getrlimit(RLIMIT_AS, &old);
+    struct rlimit limit = old;
+    limit.rlim_cur = VmSize() + HEADROOM;
+    if (setrlimit(RLIMIT_AS, &limit) != 0) {
+        printf("can't limit address space, skipping\n");
+        return 0;
+    }
+
+    // allocations fail cleanly, rather than crash
+    std::vector<void*> ptrs;
+    ptrs.reserve(1 << 22);
+    size_t sizes[] = { 64, 3000, 100000, 1 << 20 };
+    for (size_t size : sizes) {
+        if (!Exhaust(ptrs, size, 0, false) || !Exhaust(ptrs, size, 0, true)
+            || !Exhaust(ptrs, size, 1 << 16, false)) {
+            return 1;
+        }
+    }
+
+    // batch stops short, with the blocks it got
+    void* batch[4096];
+    size_t got = lf_malloc_batch(256, 4096, batch);
+    lf_free_batch(batch, got);
+
+    // a large block that can't grow is left untouched
+    char* block = (char*)malloc(1 << 20);
+    if (block) {
+        memset(block, 0x3C, 1 << 20);
+        if (realloc(block, HEADROOM * 2) != nullptr) {
+            printf("realloc past the address space limit didn't fail\n");
+            return 1;
+        }
+
+        for (size_t idx = 0; idx < (1 << 20); idx += 4096) {
+            if (block[idx] != 0x3C) {
+                printf("failed realloc changed the block\n");
+                return 1;
+            }
+        }
+
+        free(block);
+    }
+
+    for (void* ptr : ptrs) {
+        free(ptr);
+    }
+
+    // allocations work again once memory is available
+    setrlimit(RLIMIT_AS, &old);
+    for (size_t size : sizes) {
+        void* ptr = malloc(size);
+        if (ptr == nullptr) {
+            printf("malloc of %zu bytes failed after recovering\n", size);
+            return 1;
+        }
+
+        memset(ptr, 0, size);
+        free(ptr);
+    }
+
+    printf("Out of memory tests passed\n");
+    return 0;
+}
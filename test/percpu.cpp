@@ -0,0 +1,94 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+
+// more threads than cpus, so that threads get preempted and migrate
+//  while in cpu cache critical sections (LFMALLOC_PERCPU), and signals
+//  to abort critical sections often
+// a block handed out twice shows up as a tag overwritten by another thread
+#define THREADS_PER_CPU 8
+#define ROUNDS 20000
+#define BLOCKS 64
+
+static std::atomic<bool> sFailed(false);
+// threads stay alive until sDone, so the signaler never targets an
+//  exited thread
+static std::atomic<size_t> sRunning(0);
+static std::atomic<bool> sDone(false);
+
+static void OnSignal(int)
+{
+}
+
+static void Run(uint64_t tag)
+{
+    uint64_t* blocks[BLOCKS];
+    for (size_t round = 0; round < ROUNDS && !sFailed; ++round) {
+        size_t size = 16 + (round % 4) * 16;
+        for (uint64_t*& block : blocks) {
+            block = (uint64_t*)malloc(size);
+            block[0] = tag;
+            block[1] = round;
+        }
+
+        sched_yield();
+
+        for (uint64_t* block : blocks) {
+            if (block[0] != tag || block[1] != round) {
+                printf("block %p handed out to two threads\n", block);
+                sFailed = true;
+            }
+
+            free(block);
+        }
+    }
+
+    sRunning--;
+    while (!sDone) {
+        sched_yield();
+    }
+}
+
+int main()
+{
+    printf("Per-cpu cache tests\n");
+
+    size_t threadNum = std::thread::hardware_concurrency() * THREADS_PER_CPU;
+    threadNum = std::max<size_t>(threadNum, THREADS_PER_CPU);
+
+    struct sigaction action = {};
+    action.sa_handler = OnSignal;
+    sigaction(SIGUSR1, &action, nullptr);
+
+    std::vector<std::thread> threads;
+    sRunning = threadNum;
+    for (size_t idx = 0; idx < threadNum; ++idx) {
+        threads.emplace_back(Run, idx);
+    }
+
+    std::thread signaler([&]() {
+        while (sRunning > 0) {
+            for (std::thread& thread : threads) {
+                pthread_kill(thread.native_handle(), SIGUSR1);
+            }
+
+            sched_yield();
+        }
+    });
+
+    signaler.join();
+    sDone = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    return sFailed ? 1 : 0;
+}
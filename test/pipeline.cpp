@@ -0,0 +1,93 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <array>
+#include <atomic>
+#include <thread>
+
+// single producer, single consumer ring of blocks
+struct Ring {
+    static constexpr size_t size = 1024;
+    std::atomic<size_t> head { 0 };
+    std::atomic<size_t> tail { 0 };
+    uint8_t* slots[size];
+
+    void push(uint8_t* block)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        while (t - head.load(std::memory_order_acquire) == size) {
+            std::this_thread::yield();
+        }
+
+        slots[t % size] = block;
+        tail.store(t + 1, std::memory_order_release);
+    }
+
+    uint8_t* pop()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        while (tail.load(std::memory_order_acquire) == h) {
+            std::this_thread::yield();
+        }
+
+        uint8_t* block = slots[h % size];
+        head.store(h + 1, std::memory_order_release);
+        return block;
+    }
+};
+
+int main()
+{
+    printf("Pipeline tests\n");
+
+    // producers allocate, consumers free, blocks always cross threads
+    constexpr size_t numPairs = 4;
+    constexpr size_t numAllocs = 200000;
+
+    std::array<Ring, numPairs> rings;
+    std::array<std::thread, numPairs * 2> threads;
+    std::atomic<bool> failed { false };
+
+    for (size_t p = 0; p < numPairs; ++p) {
+        threads[p * 2] = std::thread([p, &rings]() {
+            for (size_t i = 0; i < numAllocs; ++i) {
+                size_t size = 8 + (i * 7919 + p) % 2048;
+                uint8_t* block = static_cast<uint8_t*>(malloc(size));
+                memset(block, (uint8_t)size, size);
+                // producer also frees some of its own blocks
+                if (i % 8 == 0) {
+                    free(block);
+                    block = static_cast<uint8_t*>(malloc(size));
+                    memset(block, (uint8_t)size, size);
+                }
+
+                rings[p].push(block);
+            }
+        });
+
+        threads[p * 2 + 1] = std::thread([p, &rings, &failed]() {
+            for (size_t i = 0; i < numAllocs; ++i) {
+                size_t size = 8 + (i * 7919 + p) % 2048;
+                uint8_t* block = rings[p].pop();
+                for (size_t k = 0; k < size; ++k) {
+                    if (block[k] != (uint8_t)size) {
+                        printf("block %p of size %zu corrupted at offset %zu\n",
+                            block, size, k);
+                        failed = true;
+                        break;
+                    }
+                }
+
+                free(block);
+            }
+        });
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    return failed ? 1 : 0;
+}
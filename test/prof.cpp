@@ -0,0 +1,85 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <vector>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "../lrmalloc.h"
+
+int main()
+{
+    printf("Profiling tests\n");
+
+    std::vector<void*> allocs;
+    for (size_t i = 0; i < 100000; ++i) {
+        allocs.push_back(malloc(64 + i % 1024));
+    }
+
+    // realloc and free must keep track of sampled blocks
+    for (size_t i = 0; i < allocs.size(); i += 2) {
+        allocs[i] = realloc(allocs[i], 8192);
+    }
+
+    for (size_t i = 0; i < allocs.size(); i += 4) {
+        free(allocs[i]);
+        allocs[i] = nullptr;
+    }
+
+    FILE* file = tmpfile();
+    int ret = lf_prof_dump(fileno(file));
+    if (ret == ENOENT) {
+        // built without LFMALLOC_PROF or LFMALLOC_PROF_RATE not set
+        if (getenv("LFMALLOC_PROF_RATE") != nullptr) {
+            printf("LFMALLOC_PROF_RATE set, but sampling disabled\n");
+            return 1;
+        }
+
+        printf("sampling disabled\n");
+    } else {
+        char line[256];
+        unsigned long objs;
+        unsigned long bytes;
+        rewind(file);
+        if (ret != 0 || fgets(line, sizeof(line), file) == nullptr
+            || sscanf(line, "heap profile: %lu: %lu", &objs, &bytes) != 2) {
+            printf("bad heap profile\n");
+            return 1;
+        }
+
+        printf("%lu live samples, %lu bytes\n", objs, bytes);
+        if (objs == 0) {
+            printf("no live samples\n");
+            return 1;
+        }
+    }
+
+    fclose(file);
+
+    // dump on signal, see lrmalloc.h for the file name
+    const char* signo = getenv("LFMALLOC_PROF_SIGNAL");
+    if (ret == 0 && signo != nullptr) {
+        raise(atoi(signo));
+        char path[64];
+        snprintf(path, sizeof(path), "lrmalloc.%d.0.heap", (int)getpid());
+        file = fopen(path, "r");
+        char line[256];
+        if (file == nullptr || fgets(line, sizeof(line), file) == nullptr
+            || strncmp(line, "heap profile: ", 14) != 0) {
+            printf("no heap profile dumped to %s\n", path);
+            return 1;
+        }
+
+        fclose(file);
+        unlink(path);
+    }
+
+    for (void* ptr : allocs) {
+        free(ptr);
+    }
+
+    return 0;
+}
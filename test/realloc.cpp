@@ -0,0 +1,88 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <errno.h>
+#include <malloc.h>
+
+// check that buffer still holds the pattern written by fill
+static void check(uint8_t* buffer, size_t from, size_t to)
+{
+    for (size_t k = from; k < to; ++k) {
+        if (buffer[k] != (uint8_t)(k * 31)) {
+            printf("buffer %p corrupted at offset %zu\n", buffer, k);
+            ::exit(1);
+        }
+    }
+}
+
+static void fill(uint8_t* buffer, size_t from, size_t to)
+{
+    for (size_t k = from; k < to; ++k) {
+        buffer[k] = (uint8_t)(k * 31);
+    }
+}
+
+int main()
+{
+    printf("Realloc tests\n");
+
+    // append-style growth, from small blocks to multi-MB large blocks
+    size_t size = 16;
+    uint8_t* buffer = static_cast<uint8_t*>(malloc(size));
+    fill(buffer, 0, size);
+    while (size < (64 << 20)) {
+        size_t newSize = size + size / 2 + 1;
+        buffer = static_cast<uint8_t*>(realloc(buffer, newSize));
+        check(buffer, 0, size);
+        fill(buffer, size, newSize);
+        if (malloc_usable_size(buffer) < newSize) {
+            printf("usable size %zu < %zu\n", malloc_usable_size(buffer), newSize);
+            return 1;
+        }
+
+        size = newSize;
+    }
+
+    // shrink back down, content prefix must be preserved
+    while (size > 16) {
+        size /= 3;
+        buffer = static_cast<uint8_t*>(realloc(buffer, size));
+        check(buffer, 0, size);
+    }
+
+    free(buffer);
+
+    // aligned large blocks don't start at their mapping
+    size = 1 << 20;
+    buffer = static_cast<uint8_t*>(aligned_alloc(1 << 16, size));
+    fill(buffer, 0, size);
+    buffer = static_cast<uint8_t*>(realloc(buffer, size * 4));
+    check(buffer, 0, size);
+    free(buffer);
+
+    // sizes whose page ceiling overflows fail, block is left untouched
+    size = 1 << 20;
+    buffer = static_cast<uint8_t*>(malloc(size));
+    fill(buffer, 0, size);
+    size_t deltas[] = { 0, 1, 100, 4095 };
+    for (size_t delta : deltas) {
+        volatile size_t hugeSize = SIZE_MAX - delta;
+        errno = 0;
+        if (realloc(buffer, hugeSize) != nullptr || errno != ENOMEM) {
+            printf("realloc of %zu bytes didn't fail\n", (size_t)hugeSize);
+            return 1;
+        }
+
+        if (malloc(hugeSize) != nullptr) {
+            printf("malloc of %zu bytes didn't fail\n", (size_t)hugeSize);
+            return 1;
+        }
+
+        check(buffer, 0, size);
+    }
+
+    free(buffer);
+
+    return 0;
+}
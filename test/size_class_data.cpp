@@ -2,22 +2,26 @@
 
 #include "../size_classes.h"
 
-#define SIZE_CLASS_bin_yes(blockSize, pages) { blockSize, pages * PAGE },
-#define SIZE_CLASS_bin_no(blockSize, pages)
-
-#define SC(index, lg_grp, lg_delta, ndelta, psz, bin, pgs, lg_delta_lookup) \
-    SIZE_CLASS_bin_##bin((1U << lg_grp) + (ndelta << lg_delta), pgs)
-
-
 int main()
 {
-    SizeClassData SizeClasses[MAX_SZ_IDX] = { { 0, 0 }, SIZE_CLASSES };
+    InitSizeClass();
     // each superblock has to contain several blocks
-    // and it has to contain blocks *perfectly*
-    //  e.g no space left after last block
     for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
         SizeClassData& sc = SizeClasses[scIdx];
         // size class large enough to store several elements
-        assert(SB_SIZE >= (sc.blockSize * 2));
+        assert(sc.sbSize >= (sc.blockSize * 2));
+        assert(sc.blockNum == sc.sbSize / sc.blockSize);
+        // superblocks are made of SB_SIZE chunks
+        assert((sc.sbSize % SB_SIZE) == 0);
     }
+
+    // each size maps to the smallest size class that fits it
+    for (size_t size = 1; size <= MAX_SZ; ++size) {
+        size_t scIdx = GetSizeClass(size);
+        assert(scIdx > 0 && scIdx < MAX_SZ_IDX);
+        assert(SizeClasses[scIdx].blockSize >= size);
+        assert(scIdx == 1 || SizeClasses[scIdx - 1].blockSize < size);
+    }
+
+    assert(SizeClasses[GetSizeClass(MAX_SZ)].blockSize == MAX_SZ);
 }
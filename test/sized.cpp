@@ -0,0 +1,93 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <vector>
+
+#include "../lrmalloc.h"
+
+int main()
+{
+    printf("Sized free tests\n");
+
+    // sampled blocks are served differently, can't check reuse
+    bool sampling = getenv("LFMALLOC_PROF_RATE") != nullptr;
+    for (size_t size = 0; size <= 64 * 1024; size = size * 3 / 2 + 1) {
+        void* ptr = malloc(size);
+        free_sized(ptr, size);
+        void* again = malloc(size);
+        if (again != ptr && !sampling) {
+            printf("free_sized of %zu bytes didn't reuse block\n", size);
+            return 1;
+        }
+
+        free_sized(again, size);
+    }
+
+    free_sized(nullptr, 16);
+    free_sized(malloc(4 << 20), 4 << 20);
+    free_sized(calloc(100, 24), 100 * 24);
+
+    // realloc shrinking to another size class moves the block
+    for (size_t size = 16; size <= 64 * 1024; size *= 2) {
+        char* ptr = (char*)malloc(size);
+        memset(ptr, 0x5A, size);
+        size_t newSize = size / 4 + 1;
+        ptr = (char*)realloc(ptr, newSize);
+        for (size_t i = 0; i < newSize; ++i) {
+            if (ptr[i] != 0x5A) {
+                printf("realloc from %zu to %zu lost data\n", size, newSize);
+                return 1;
+            }
+        }
+
+        free_sized(ptr, newSize);
+    }
+
+    // so does realloc of a large block to a small size, which free_sized
+    //  then returns to the small size class
+    for (size_t alignment = 0; alignment <= 8192; alignment += 8192) {
+        char* ptr = (char*)(alignment ? aligned_alloc(alignment, 1 << 20) : malloc(1 << 20));
+        memset(ptr, 0x3C, 100);
+        ptr = (char*)realloc(ptr, 100);
+        for (size_t i = 0; i < 100; ++i) {
+            if (ptr[i] != 0x3C) {
+                printf("realloc of large block to 100 bytes lost data\n");
+                return 1;
+            }
+        }
+
+        free_sized(ptr, 100);
+        void* again = malloc(100);
+        if (again != ptr && !sampling) {
+            printf("free_sized of large block realloc'd to 100 bytes didn't reuse block\n");
+            return 1;
+        }
+
+        memset(again, 0, 100);
+        free_sized(again, 100);
+    }
+
+    for (size_t alignment = 16; alignment <= 8192; alignment *= 2) {
+        std::vector<void*> ptrs;
+        for (size_t size = alignment; size <= 64 * 1024; size += alignment * 3) {
+            void* ptr = aligned_alloc(alignment, size);
+            if ((uintptr_t)ptr & (alignment - 1)) {
+                printf("%zu bytes not aligned to %zu\n", size, alignment);
+                return 1;
+            }
+
+            memset(ptr, 0x1, size);
+            ptrs.push_back(ptr);
+        }
+
+        size_t size = alignment;
+        for (void* ptr : ptrs) {
+            free_aligned_sized(ptr, alignment, size);
+            size += alignment * 3;
+        }
+    }
+
+    return 0;
+}
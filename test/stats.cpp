@@ -0,0 +1,113 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <thread>
+#include <vector>
+
+#include "../lrmalloc.h"
+
+static uint64_t read(const char* name)
+{
+    uint64_t val = 0;
+    size_t len = sizeof(val);
+    int ret = lf_mallctl(name, &val, &len, nullptr, 0);
+    if (ret != 0) {
+        printf("mallctl %s failed: %d\n", name, ret);
+        ::exit(1);
+    }
+
+    return val;
+}
+
+int main()
+{
+    printf("Stats tests\n");
+
+    uint64_t val;
+    size_t len = sizeof(val);
+    if (lf_mallctl("no.such.name", &val, &len, nullptr, 0) != ENOENT
+        || lf_mallctl("bins.999.size", &val, &len, nullptr, 0) != ENOENT
+        || lf_mallctl("bins.count", &val, &len, &val, len) != EPERM) {
+        printf("bad names or writes accepted\n");
+        return 1;
+    }
+
+    len = 1;
+    if (lf_mallctl("bins.count", &val, &len, nullptr, 0) != EINVAL) {
+        printf("bad length accepted\n");
+        return 1;
+    }
+
+    // find size class of 64 byte blocks
+    uint64_t scIdx = 0;
+    char name[64];
+    for (uint64_t idx = 1; idx < read("bins.count"); ++idx) {
+        snprintf(name, sizeof(name), "bins.%lu.size", (unsigned long)idx);
+        if (read(name) == 64) {
+            scIdx = idx;
+        }
+    }
+
+    if (scIdx == 0) {
+        printf("no size class for 64 bytes\n");
+        return 1;
+    }
+
+    std::vector<void*> allocs;
+    for (size_t i = 0; i < 1000; ++i) {
+        allocs.push_back(malloc(64));
+    }
+
+    void* large = malloc(4 << 20);
+    if (read("thread.tcache.cached") == 0 && read("stats.descriptors.active") == 0) {
+        printf("no cached blocks or descriptors\n");
+        return 1;
+    }
+
+    if (read("stats.enabled")) {
+        // sampled blocks (LFMALLOC_PROF_RATE) come from their size class
+        //  and are counted like the others, see the statsprof variant
+        snprintf(name, sizeof(name), "stats.bins.%lu.nmalloc", (unsigned long)scIdx);
+        uint64_t mallocs = read(name);
+        if (mallocs < 1000 || read("stats.large.allocated") < (4 << 20)
+            || read("stats.superblocks.mapped") == 0) {
+            printf("counters too low\n");
+            return 1;
+        }
+
+        // frees of another thread are counted too
+        std::thread([&allocs]() {
+            for (void* ptr : allocs) {
+                free(ptr);
+            }
+        }).join();
+
+        snprintf(name, sizeof(name), "stats.bins.%lu.nfree", (unsigned long)scIdx);
+        if (read(name) < 1000) {
+            printf("frees of exited thread not counted\n");
+            return 1;
+        }
+
+        // destroyed arenas leave no allocated bytes behind
+        uint64_t allocated = read("stats.small.allocated");
+        lf_arena_t* arena = lf_arena_create();
+        for (size_t i = 0; i < 1000; ++i) {
+            lf_arena_malloc(arena, 64);
+        }
+
+        lf_arena_destroy(arena);
+        if (read("stats.small.allocated") != allocated) {
+            printf("arena blocks still counted as allocated\n");
+            return 1;
+        }
+    } else {
+        for (void* ptr : allocs) {
+            free(ptr);
+        }
+    }
+
+    free(large);
+    return 0;
+}
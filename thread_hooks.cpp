@@ -8,9 +8,12 @@
 #include <dlfcn.h>
 #include <pthread.h>
 
+#include "arena.h"
 #include "size_classes.h"
 #include "tcache.h"
 #include "mapcache.h"
+#include "remote.h"
+#include "stats.h"
 
 // handle process init/exit hooks
 pthread_key_t destructor_key;
@@ -37,11 +40,19 @@ void lf_malloc_thread_initialize()
 
 void lf_malloc_thread_finalize()
 {
+#if LFMALLOC_REMOTE_FREE
+    // hand out blocks of other threads before flushing caches
+    RemoteFinalize();
+#endif
+    // arena blocks go back to their arena, if it's still alive
+    ArenaCacheFlush(&sArenaCache);
+
     // flush caches
     for (size_t scIdx = 1; scIdx < MAX_SZ_IDX; ++scIdx) {
-        FlushCache(scIdx, &TCache[scIdx]);
+        FlushCache(scIdx, &TCache[scIdx], TCache[scIdx].GetBlockNum());
     }
     sMapCache.Flush();
+    FinalizeThreadStats();
 }
 
 LFMALLOC_ATTR(constructor)